@@ -0,0 +1,92 @@
+import math
+from datetime import datetime, timedelta
+from typing import List, Optional, Dict, Any, Tuple
+from sqlalchemy import Integer, cast, func, select
+from sqlmodel import Session
+
+from models.base import Measurement, MeasurementRollup, MeasurementType, ROLLUP_RESOLUTIONS
+
+# Naive timestamps are bucketed as UTC by SQLite's strftime('%s'), and mapped back the same way
+_EPOCH = datetime(1970, 1, 1)
+
+# Tier names accepted by the API, 0 is the raw measurements
+RESOLUTIONS = {"raw": 0, **{str(r): r for r in ROLLUP_RESOLUTIONS}}
+
+
+def choose_tier(span: float, points: int, resolution: str = "auto") -> Tuple[int, int]:
+    """
+    Pick the storage tier and bucket width for about `points` buckets over `span` seconds
+
+    Args:
+        span: Requested time span in seconds
+        points: Maximum number of buckets wanted
+        resolution: "auto", or a key of RESOLUTIONS to force a tier
+
+    Returns:
+        (tier, width): tier in seconds (0 = raw), bucket width in seconds, a multiple of tier
+    """
+    target = max(span / points, 1.0)
+    if resolution == "auto":
+        # Coarsest tier that is still finer than the buckets asked for
+        tier = max([r for r in ROLLUP_RESOLUTIONS if r <= target], default=0)
+    else:
+        tier = RESOLUTIONS[resolution]
+
+    step = tier or 1
+    return tier, max(math.ceil(target / step), 1) * step
+
+
+def query_aggregates(session: Session, start_time: datetime, end_time: datetime, points: int,
+                     resolution: str = "auto", sensor_id: Optional[int] = None,
+                     measurement_type: Optional[MeasurementType] = None) -> List[Dict[str, Any]]:
+    """
+    min/max/mean per bucket and per sensor/type, newest first
+
+    Buckets are read from the tier chosen by choose_tier() and merged in SQL to the final
+    width, so the cost follows the span and the tier, not how many samples were stored.
+    """
+    tier, width = choose_tier((end_time - start_time).total_seconds(), points, resolution)
+
+    if tier:
+        table = MeasurementRollup
+        timestamp = table.bucket
+        count, total = func.sum(table.count), func.sum(table.sum)
+        low, high = func.min(table.min), func.max(table.max)
+        # A rollup row covers [bucket, bucket + tier), keep the ones overlapping the span
+        filters = [table.resolution == tier, timestamp > start_time - timedelta(seconds=tier)]
+    else:
+        table = Measurement
+        timestamp = table.timestamp
+        count, total = func.count(table.value), func.sum(table.value)
+        low, high = func.min(table.value), func.max(table.value)
+        filters = [table.value.is_not(None), timestamp >= start_time]
+
+    filters.append(timestamp < end_time)
+    if sensor_id is not None:
+        filters.append(table.sensor_id == sensor_id)
+    if measurement_type is not None:
+        filters.append(table.measurement_type == measurement_type)
+
+    slot = cast(func.strftime('%s', timestamp), Integer) // width
+    query = (
+        select(table.sensor_id, table.measurement_type, func.min(table.unit), slot,
+               count, total, low, high)
+        .where(*filters)
+        .group_by(table.sensor_id, table.measurement_type, slot)
+        .order_by(slot.desc())
+    )
+
+    return [
+        {
+            "sensor_id": sensor,
+            "measurement_type": kind,
+            "unit": unit,
+            "timestamp": (_EPOCH + timedelta(seconds=index * width)).isoformat(),
+            "resolution": width,
+            "count": n,
+            "mean": s / n,
+            "min": lo,
+            "max": hi,
+        }
+        for sensor, kind, unit, index, n, s, lo, hi in session.execute(query).all()
+    ]
@@ -8,6 +8,7 @@ from models.base import Controller, ControllerType, Sensor, SensorControllerLink
 from models.controller_schemas import validate_controller_config, get_controller_schema
 from controllers.base import ControllerRegistry
 from database import engine
+from scheduler_instance import scheduler
 
 router = APIRouter(
     prefix="/controllers",
@@ -88,6 +89,7 @@ async def create_controller(controller_create: ControllerCreate, session: Sessio
     session.add(controller)
     session.commit()
     session.refresh(controller)
+    scheduler.invalidate_controller(controller.id)
     return controller
 
 @router.put("/{controller_id}", response_model=Controller)
@@ -122,6 +124,7 @@ async def update_controller(
     session.add(db_controller)
     session.commit()
     session.refresh(db_controller)
+    scheduler.invalidate_controller(controller_id)
     return db_controller
 
 @router.delete("/{controller_id}", response_model=dict)
@@ -133,6 +136,7 @@ async def delete_controller(controller_id: int, session: Session = Depends(get_s
     
     session.delete(controller)
     session.commit()
+    scheduler.invalidate_controller(controller_id)
     return {"message": f"Controller {controller_id} deleted"}
 
 @router.get("/{controller_id}/sensors", response_model=List[Sensor])
@@ -174,6 +178,7 @@ async def add_sensor_to_controller(
     link = SensorControllerLink(sensor_id=sensor_id, controller_id=controller_id)
     session.add(link)
     session.commit()
+    scheduler.invalidate_controller(controller_id)
     
     return {"message": f"Sensor {sensor_id} added to controller {controller_id}"}
 
@@ -198,6 +203,7 @@ async def remove_sensor_from_controller(
     # Remove the association
     session.delete(link)
     session.commit()
+    scheduler.invalidate_controller(controller_id)
     
     return {"message": f"Sensor {sensor_id} removed from controller {controller_id}"}
 
@@ -226,6 +232,7 @@ async def process_controller(controller_id: int, session: Session = Depends(get_
     controller_db.last_run = datetime.now()
     session.add(controller_db)
     session.commit()
+    scheduler.invalidate_controller(controller_id)
     
     if result:
         # Record the action if there is a result
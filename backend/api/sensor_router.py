@@ -8,6 +8,8 @@ from pydantic import BaseModel as PydanticBaseModel
 from models.base import Sensor, Measurement, MeasurementType
 from sensors.base import SensorRegistry
 from database import engine
+from scheduler_instance import scheduler
+from api.aggregates import query_aggregates, RESOLUTIONS
 
 router = APIRouter(
     prefix="/sensors",
@@ -75,6 +77,7 @@ async def create_sensor(sensor_data: SensorCreate, session: Session = Depends(ge
     session.add(sensor)
     session.commit()
     session.refresh(sensor)
+    scheduler.invalidate_sensor(sensor.id)
     return sensor
 
 @router.put("/{sensor_id}", response_model=Sensor)
@@ -100,6 +103,7 @@ async def update_sensor(sensor_id: int, sensor_update: SensorCreate, session: Se
     session.add(db_sensor)
     session.commit()
     session.refresh(db_sensor)
+    scheduler.invalidate_sensor(sensor_id)
     return db_sensor
 
 @router.delete("/{sensor_id}", response_model=dict)
@@ -111,6 +115,7 @@ async def delete_sensor(sensor_id: int, session: Session = Depends(get_session))
     
     session.delete(sensor)
     session.commit()
+    scheduler.invalidate_sensor(sensor_id)
     return {"message": f"Sensor {sensor_id} deleted"}
 
 @router.get("/{sensor_id}/measurements", response_model=List[Measurement])
@@ -142,4 +147,36 @@ async def get_sensor_measurements(
     
     # Execute query
     measurements = session.exec(query).all()
-    return measurements
\ No newline at end of file
+    return measurements
+
+@router.get("/{sensor_id}/measurements/aggregate", response_model=List[Dict[str, Any]])
+async def get_sensor_measurement_aggregates(
+    sensor_id: int,
+    start_time: Optional[datetime] = None,
+    end_time: Optional[datetime] = None,
+    points: int = Query(500, ge=1, le=5000),
+    resolution: str = "auto",
+    measurement_type: Optional[MeasurementType] = None,
+    session: Session = Depends(get_session)
+):
+    """
+    min/max/mean of a sensor's measurements over at most `points` buckets, newest first
+    
+    The tier (raw, 1 minute or 1 hour rollups) is picked from the span and points, unless
+    forced with resolution. Defaults to the last 24 hours.
+    """
+    sensor = session.get(Sensor, sensor_id)
+    if not sensor:
+        raise HTTPException(status_code=404, detail="Sensor not found")
+    
+    if resolution != "auto" and resolution not in RESOLUTIONS:
+        raise HTTPException(status_code=400,
+                            detail=f"resolution must be auto or one of {', '.join(RESOLUTIONS)}")
+    
+    end_time = end_time or datetime.now()
+    start_time = start_time or end_time - timedelta(hours=24)
+    if start_time >= end_time:
+        raise HTTPException(status_code=400, detail="start_time must be before end_time")
+    
+    return query_aggregates(session, start_time, end_time, points, resolution,
+                            sensor_id=sensor_id, measurement_type=measurement_type)
\ No newline at end of file
@@ -1,12 +1,13 @@
-from fastapi import APIRouter, Depends, HTTPException
+from fastapi import APIRouter, Depends, HTTPException, Query
 from sqlmodel import Session, select, func
-from typing import List, Dict, Any
+from typing import List, Dict, Any, Optional
 from datetime import datetime, timedelta
 import json
 
 from models.base import Sensor, Controller, Measurement, ControlAction
 from database import engine
 from scheduler_instance import scheduler
+from api.aggregates import query_aggregates
 
 router = APIRouter(
     prefix="/system",
@@ -124,10 +125,23 @@ async def stop_scheduler():
     return {"message": "Scheduler stopped"}
 
 @router.get("/measurements/recent", response_model=List[Dict[str, Any]])
-async def get_recent_measurements(hours: int = 24, session: Session = Depends(get_session)):
-    """Get recent measurements from all sensors"""
+async def get_recent_measurements(hours: int = 24, points: Optional[int] = Query(None, ge=1, le=5000),
+                                  session: Session = Depends(get_session)):
+    """
+    Get recent measurements from all sensors
+    
+    With points, return at most that many buckets per sensor and type instead of every
+    row, read from the rollup tiers (value is the bucket mean, plus min/max/count)
+    """
     # Calculate the start time
-    start_time = datetime.now() - timedelta(hours=hours)
+    end_time = datetime.now()
+    start_time = end_time - timedelta(hours=hours)
+    
+    if points:
+        buckets = query_aggregates(session, start_time, end_time, points)
+        for bucket in buckets:
+            bucket["value"] = bucket["mean"]
+        return buckets
     
     # Query for measurements after the start time
     query = select(Measurement).where(Measurement.timestamp >= start_time).order_by(Measurement.timestamp.desc())
@@ -13,6 +13,7 @@ from api.controller_router import router as controller_router
 from api.system_router import router as system_router
 from api.output_router import router as output_router
 from scheduler_instance import scheduler
+from scheduler.ingest import backfill_rollups
 
 from controllers.base import initialize_controllers
 from sensors.base import initialize_sensors
@@ -21,6 +22,8 @@ from controllers.outputs import initialize_outputs
 # Create tables on startup
 def create_db_and_tables():
     SQLModel.metadata.create_all(engine)
+    # Databases from before the rollup tiers: build them once from the raw history
+    backfill_rollups(engine)
 
 @asynccontextmanager
 async def lifespan(app: FastAPI):
@@ -1,6 +1,6 @@
 from typing import List, Optional, Dict, Any
 from sqlmodel import Field, SQLModel, Relationship
-from sqlalchemy import Column, JSON, String
+from sqlalchemy import Column, JSON, String, UniqueConstraint
 from datetime import datetime
 from enum import Enum, auto
 import json
@@ -81,6 +81,26 @@ class Measurement(SQLModel, table=True):
     # Relationships
     sensor: Optional[Sensor] = Relationship(back_populates="measurements")
 
+# Rollup tiers, as bucket lengths in seconds: 1 minute and 1 hour
+ROLLUP_RESOLUTIONS = (60, 3600)
+
+# Per-bucket min/max/sum/count of Measurement, maintained at ingest (see scheduler/ingest.py)
+class MeasurementRollup(SQLModel, table=True):
+    __table_args__ = (UniqueConstraint("sensor_id", "measurement_type", "resolution", "bucket"),)
+    
+    id: Optional[int] = Field(default=None, primary_key=True)
+    resolution: int  # seconds, one of ROLLUP_RESOLUTIONS
+    bucket: datetime = Field(index=True)  # bucket start
+    measurement_type: MeasurementType
+    unit: str
+    count: int
+    sum: float
+    min: float
+    max: float
+    
+    # Foreign keys
+    sensor_id: Optional[int] = Field(default=None, foreign_key="sensor.id")
+
 # Controller Create model (for API requests)
 class ControllerCreate(SQLModel):
     name: str
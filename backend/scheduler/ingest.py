@@ -0,0 +1,215 @@
+import threading
+import time
+from datetime import datetime, timedelta
+from typing import Any, Dict, List, Optional, Sequence
+from sqlalchemy import Integer, cast, func, insert, literal, select
+from sqlalchemy.dialects.sqlite import insert as sqlite_insert
+from models.base import Measurement, MeasurementRollup, MeasurementType, ROLLUP_RESOLUTIONS
+
+# Rows per executemany, and the longest a row waits before it is written
+DEFAULT_BATCH_SIZE = 5000
+DEFAULT_FLUSH_INTERVAL = 10.0
+
+# Pending rows kept while the database refuses writes, oldest dropped first
+MAX_PENDING_BATCHES = 10
+
+# Naive timestamps are bucketed as if they were UTC, the same way as SQLite's strftime('%s')
+_EPOCH = datetime(1970, 1, 1)
+
+
+def bucket_start(timestamp: datetime, resolution: int) -> datetime:
+    """Start of the `resolution` seconds bucket holding timestamp"""
+    seconds = int((timestamp - _EPOCH).total_seconds())
+    return _EPOCH + timedelta(seconds=seconds - seconds % resolution)
+
+
+def update_rollups(conn, rows: Sequence[Dict[str, Any]]):
+    """
+    Fold measurement rows into every rollup tier, within the caller's transaction
+
+    Args:
+        conn: Connection (or session.connection()) the rows are being written with
+        rows: Measurement rows as column dicts
+    """
+    buckets: Dict[tuple, Dict[str, Any]] = {}
+    for row in rows:
+        value = row['value']
+        for resolution in ROLLUP_RESOLUTIONS:
+            key = (row['sensor_id'], row['measurement_type'], resolution,
+                   bucket_start(row['timestamp'], resolution))
+            bucket = buckets.get(key)
+            if bucket is None:
+                buckets[key] = {
+                    'sensor_id': key[0], 'measurement_type': key[1], 'resolution': resolution,
+                    'bucket': key[3], 'unit': row['unit'],
+                    'count': 1, 'sum': value, 'min': value, 'max': value,
+                }
+            else:
+                bucket['count'] += 1
+                bucket['sum'] += value
+                bucket['min'] = min(bucket['min'], value)
+                bucket['max'] = max(bucket['max'], value)
+    if not buckets:
+        return
+
+    table = MeasurementRollup.__table__
+    stmt = sqlite_insert(table)
+    stmt = stmt.on_conflict_do_update(
+        index_elements=['sensor_id', 'measurement_type', 'resolution', 'bucket'],
+        set_={
+            'count': table.c['count'] + stmt.excluded['count'],
+            'sum': table.c['sum'] + stmt.excluded['sum'],
+            # Two-argument min()/max() are SQLite's scalar functions
+            'min': func.min(table.c['min'], stmt.excluded['min']),
+            'max': func.max(table.c['max'], stmt.excluded['max']),
+        }
+    )
+    conn.execute(stmt, list(buckets.values()))
+
+
+def backfill_rollups(engine):
+    """Build the rollup tiers from the stored measurements, when none exist yet"""
+    table = MeasurementRollup.__table__
+    with engine.begin() as conn:
+        if conn.execute(select(table.c.id).limit(1)).first() is not None:
+            return
+        if conn.execute(select(Measurement.__table__.c.id).limit(1)).first() is None:
+            return
+
+        source = Measurement.__table__
+        epoch = cast(func.strftime('%s', source.c.timestamp), Integer)
+        for resolution in ROLLUP_RESOLUTIONS:
+            slot = epoch // resolution
+            # Same text format as SQLAlchemy's DateTime, so ingest upserts hit these rows
+            bucket = func.datetime(slot * resolution, 'unixepoch').op('||')('.000000')
+            conn.execute(table.insert().from_select(
+                ['sensor_id', 'measurement_type', 'resolution', 'bucket', 'unit',
+                 'count', 'sum', 'min', 'max'],
+                select(source.c.sensor_id, source.c.measurement_type, literal(resolution), bucket,
+                       func.min(source.c.unit), func.count(), func.sum(source.c.value),
+                       func.min(source.c.value), func.max(source.c.value))
+                .where(source.c.value.is_not(None))
+                .group_by(source.c.sensor_id, source.c.measurement_type, slot)
+            ))
+        print("Measurement rollups built from existing history")
+
+
+class MeasurementWriter:
+    """Batched ingestion path for high-rate sensors
+
+    Rows are queued in memory and written by a background thread with one executemany
+    per flush, in a single transaction, instead of one commit per reading. A flush
+    happens once batch_size rows are pending, or flush_interval seconds after the oldest
+    pending row was queued, whichever comes first. The rollup tiers are updated in the
+    same transaction.
+    """
+
+    def __init__(self, engine, batch_size: int = DEFAULT_BATCH_SIZE,
+                 flush_interval: float = DEFAULT_FLUSH_INTERVAL):
+        """
+        Args:
+            engine: SQLAlchemy engine to write to
+            batch_size: Rows that trigger a flush
+            flush_interval: Seconds a queued row may wait before it is written
+        """
+        self.engine = engine
+        self.batch_size = batch_size
+        self.flush_interval = flush_interval
+
+        self._rows: List[Dict[str, Any]] = []
+        self._oldest = None
+        self._cond = threading.Condition()
+        self._running = False
+        self._thread = None
+
+    def start(self):
+        """Start the flush thread"""
+        if self._running:
+            return
+
+        self._running = True
+        self._thread = threading.Thread(target=self._flush_loop, daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        """Stop the flush thread, writing whatever is still pending"""
+        with self._cond:
+            self._running = False
+            self._cond.notify_all()
+        if self._thread:
+            self._thread.join(timeout=5.0)
+            self._thread = None
+        self.flush()
+
+    def add(self, sensor_id: int, measurement_type: MeasurementType, unit: str,
+            timestamps: Sequence[datetime], values: Sequence[float],
+            raw_values: Optional[Sequence[float]] = None):
+        """
+        Queue a series of measurements of one type
+
+        Args:
+            sensor_id: Sensor the samples come from
+            measurement_type: Type shared by all samples
+            unit: Unit shared by all samples
+            timestamps: One datetime per sample
+            values: Calibrated values
+            raw_values: Raw values (optional), same length as values
+        """
+        if raw_values is None:
+            raw_values = [None] * len(values)
+
+        rows = [
+            {
+                'timestamp': timestamp,
+                'measurement_type': measurement_type,
+                'value': float(value),
+                'unit': unit,
+                'raw_value': None if raw is None else float(raw),
+                'sensor_id': sensor_id,
+            }
+            for timestamp, value, raw in zip(timestamps, values, raw_values)
+        ]
+        if not rows:
+            return
+
+        with self._cond:
+            if not self._rows:
+                self._oldest = time.monotonic()
+            self._rows.extend(rows)
+            if len(self._rows) >= self.batch_size:
+                self._cond.notify_all()
+
+    def _flush_loop(self):
+        """Background thread: flush on batch size or deadline"""
+        while True:
+            with self._cond:
+                while self._running:
+                    if self._rows and (len(self._rows) >= self.batch_size or
+                                       time.monotonic() - self._oldest >= self.flush_interval):
+                        break
+                    timeout = self.flush_interval
+                    if self._rows:
+                        timeout = self._oldest + self.flush_interval - time.monotonic()
+                    self._cond.wait(timeout=max(timeout, 0.0))
+                if not self._running:
+                    return
+            self.flush()
+
+    def flush(self):
+        """Write every pending row now, in batch_size executemany chunks of one transaction"""
+        with self._cond:
+            rows, self._rows = self._rows, []
+        if not rows:
+            return
+
+        try:
+            with self.engine.begin() as conn:
+                for start in range(0, len(rows), self.batch_size):
+                    conn.execute(insert(Measurement.__table__), rows[start:start + self.batch_size])
+                update_rollups(conn, rows)
+        except Exception as e:
+            print(f"Error writing {len(rows)} measurements: {e}")
+            # Retry with the next flush, within bounds
+            with self._cond:
+                self._rows = (rows + self._rows)[-MAX_PENDING_BATCHES * self.batch_size:]
+                self._oldest = time.monotonic()
@@ -1,22 +1,59 @@
+import heapq
+import itertools
 import threading
 import time
+from concurrent.futures import ThreadPoolExecutor
 from typing import Dict, List, Any, Optional, Callable
 from datetime import datetime, timedelta
 from sqlmodel import Session, select
 from models.base import Sensor, Controller, Measurement
 from sensors.base import BaseSensor, SensorRegistry
 from controllers.base import BaseController, ControllerRegistry
+from scheduler.ingest import MeasurementWriter, DEFAULT_BATCH_SIZE, DEFAULT_FLUSH_INTERVAL, update_rollups
+
+SENSOR = "sensor"
+CONTROLLER = "controller"
+
+# Longest sleep without anything due, invalidation wakes the loop earlier
+IDLE_WAIT = 60.0
 
 class Scheduler:
-    """Scheduler for periodic sensor readings and controller actions"""
+    """Scheduler for periodic sensor readings and controller actions
+    
+    Due times are kept in memory in a heap of (due, seq, key, generation) entries, keyed
+    on ("sensor" | "controller", id). The database is read once at start, then only for
+    the items the API routers invalidate. A new generation makes older heap entries stale,
+    which are dropped when they reach the top of the heap.
+    """
     
-    def __init__(self):
-        """Initialize the scheduler"""
+    def __init__(self, max_workers: int = 4, batch_size: int = DEFAULT_BATCH_SIZE,
+                 flush_interval: float = DEFAULT_FLUSH_INTERVAL):
+        """Initialize the scheduler
+        
+        Args:
+            max_workers: Sensors read concurrently; controllers always run one at a time
+            batch_size: Sample series rows written per executemany
+            flush_interval: Longest a sample series row waits before it is written (s)
+        """
         self.running = False
         self.thread = None
         self.sensor_instances: Dict[int, BaseSensor] = {}
         self.controller_instances: Dict[int, BaseController] = {}
         self.engine = None  # Will be set when the scheduler starts
+        self.max_workers = max_workers
+        self.batch_size = batch_size
+        self.flush_interval = flush_interval
+        self.writer = None
+        
+        self._cond = threading.Condition()
+        self._queue: List[tuple] = []
+        self._seq = itertools.count()
+        self._generation: Dict[tuple, int] = {}
+        self._items: Dict[tuple, Any] = {}
+        self._busy = set()
+        self._stale = set()
+        self._sensor_pool = None
+        self._controller_pool = None
     
     def set_engine(self, engine):
         """Set the database engine"""
@@ -28,109 +65,177 @@ class Scheduler:
             return
         
         self.running = True
+        self._sensor_pool = ThreadPoolExecutor(max_workers=self.max_workers, thread_name_prefix="sensor")
+        self._controller_pool = ThreadPoolExecutor(max_workers=1, thread_name_prefix="controller")
         self.thread = threading.Thread(target=self._run, daemon=True)
         self.thread.start()
     
     def stop(self):
         """Stop the scheduler"""
         self.running = False
+        with self._cond:
+            self._cond.notify_all()
         if self.thread:
             self.thread.join(timeout=5.0)
             self.thread = None
+        # Drop runs not started yet and wait for the ones in flight, so a restart's
+        # _load_all() can clear _busy without an item running twice
+        for pool in (self._sensor_pool, self._controller_pool):
+            if pool:
+                pool.shutdown(wait=True, cancel_futures=True)
+        self._sensor_pool = self._controller_pool = None
+        if self.writer:
+            self.writer.stop()
+    
+    def invalidate_sensor(self, sensor_id: int):
+        """Reload a sensor from the database, after it was created, changed or deleted"""
+        self._invalidate((SENSOR, sensor_id))
+    
+    def invalidate_controller(self, controller_id: int):
+        """Reload a controller from the database, after it or its sensors changed"""
+        self._invalidate((CONTROLLER, controller_id))
+    
+    def _invalidate(self, key: tuple):
+        with self._cond:
+            self._stale.add(key)
+            self._cond.notify_all()
     
     def _run(self):
         """Main scheduler loop"""
         from main import engine  # Import here to avoid circular imports
         self.engine = engine
         
+        if not self.writer:
+            self.writer = MeasurementWriter(engine, self.batch_size, self.flush_interval)
+        self.writer.start()
+        
+        self._load_all()
         while self.running:
             try:
-                # Get the next sensor or controller to run
-                next_item, next_time = self._get_next_item()
-
-                if next_item:
-                    print(f"Next item: {next_item.name} ({next_item.id}) at {next_time}")
-
-                    # Sleep until the next item is due to run
-                    sleep_seconds = (next_time - datetime.now()).total_seconds()
-                    time.sleep(max(sleep_seconds, 0.0))
-
-                    # Run the sensor or controller
-                    if isinstance(next_item, Sensor):
-                        self._run_sensor(next_item)
-                    else:
-                        self._run_controller(next_item)
-                else:
-                    # No items to run, sleep for a short time
-                    time.sleep(1.0)
+                self._reload_stale()
+                
+                with self._cond:
+                    key, item, wait = self._pop_due()
+                    if key is None:
+                        # Sleep until the next item is due or something changes
+                        if not self._stale:
+                            self._cond.wait(timeout=wait)
+                        continue
+                    self._busy.add(key)
+                
+                print(f"Next item: {item.name} ({item.id})")
+                pool = self._sensor_pool if key[0] == SENSOR else self._controller_pool
+                pool.submit(self._execute, key, item)
             except Exception as e:
                 # Log the error and continue
                 print(f"Error in scheduler: {e}")
                 time.sleep(1.0)
     
-    def _get_next_item(self) -> tuple[Optional[Any], bool]:
-        """Get the next sensor or controller to run
+    @staticmethod
+    def _due_time(last: Optional[datetime], interval: int) -> datetime:
+        """Next run from the last one, or right away if it never ran"""
+        if last:
+            return last + timedelta(seconds=interval)
+        return datetime.now() - timedelta(seconds=1)
+    
+    def _push(self, key: tuple, item: Any, due: datetime):
+        """Queue an item, replacing any entry it already has (lock held)"""
+        generation = self._generation.get(key, 0) + 1
+        self._generation[key] = generation
+        self._items[key] = item
+        heapq.heappush(self._queue, (due, next(self._seq), key, generation))
+    
+    def _forget(self, key: tuple):
+        """Drop an item from the queue (lock held)"""
+        self._generation[key] = self._generation.get(key, 0) + 1
+        self._items.pop(key, None)
+    
+    def _pop_due(self) -> tuple:
+        """Take the earliest item if it is due (lock held)
         
         Returns:
-            Tuple of (item, is_sensor) where item is the sensor or controller to run
-            and is_sensor is True if the item is a sensor, False if it's a controller
+            (key, item, 0) for an item to run now, or (None, None, seconds to wait)
         """
-        with Session(self.engine) as session:
-            # Get all enabled sensors
-            sensors_stmt = select(Sensor).where(Sensor.enabled == True)
-            sensors = session.exec(sensors_stmt).all()
-            
-            # Get all enabled controllers
-            controllers_stmt = select(Controller).where(Controller.enabled == True)
-            controllers = session.exec(controllers_stmt).all()
+        while self._queue:
+            due, _, key, generation = self._queue[0]
+            if generation != self._generation.get(key):
+                heapq.heappop(self._queue)
+                continue
             
-            # Find the next sensor to run
-            next_sensor = None
-            next_sensor_time = None
+            wait = (due - datetime.now()).total_seconds()
+            if wait > 0:
+                return None, None, min(wait, IDLE_WAIT)
             
+            heapq.heappop(self._queue)
+            return key, self._items.pop(key), 0
+        
+        return None, None, IDLE_WAIT
+    
+    def _load_all(self):
+        """Queue every enabled sensor and controller"""
+        with Session(self.engine) as session:
+            sensors = session.exec(select(Sensor).where(Sensor.enabled == True)).all()
+            controllers = session.exec(select(Controller).where(Controller.enabled == True)).all()
+        
+        with self._cond:
+            self._queue.clear()
+            self._items.clear()
+            self._stale.clear()
+            self._busy.clear()
             for sensor in sensors:
-                
-                if sensor.last_measurement:
-                    # Calculate the next run time
-                    next_run = sensor.last_measurement + timedelta(seconds=sensor.update_interval)
-                else:
-                    # No previous measurement, run immediately
-                    next_run = datetime.now() - timedelta(seconds=1)
-                
-                # Check if this sensor should run next
-                if next_sensor_time is None or next_run < next_sensor_time:
-                    next_sensor = sensor
-                    next_sensor_time = next_run
-            
-            # Find the next controller to run
-            next_controller = None
-            next_controller_time = None
-            
+                self._push((SENSOR, sensor.id), sensor, self._due_time(sensor.last_measurement, sensor.update_interval))
             for controller in controllers:
-                if controller.last_run:
-                    # Calculate the next run time
-                    next_run = controller.last_run + timedelta(seconds=controller.update_interval)
-                else:
-                    # No previous run, run immediately
-                    next_run = datetime.now() - timedelta(seconds=1)
-                
-                # Check if this controller should run next
-                if next_controller_time is None or next_run < next_controller_time:
-                    next_controller = controller
-                    next_controller_time = next_run
-            
-            # Determine whether to run a sensor or controller next
-            if next_sensor_time and next_controller_time:
-                if next_sensor_time <= next_controller_time:
-                    return next_sensor, next_sensor_time
+                self._push((CONTROLLER, controller.id), controller, self._due_time(controller.last_run, controller.update_interval))
+    
+    def _reload_stale(self):
+        """Re-read invalidated items that are not running, and drop their instances"""
+        with self._cond:
+            keys = [key for key in self._stale if key not in self._busy]
+            self._stale.difference_update(keys)
+        if not keys:
+            return
+        
+        rows = {}
+        with Session(self.engine) as session:
+            for key in keys:
+                rows[key] = session.get(Sensor if key[0] == SENSOR else Controller, key[1])
+        
+        for key in keys:
+            self._drop_instance(key)
+        
+        with self._cond:
+            for key, row in rows.items():
+                if not row or not row.enabled:
+                    self._forget(key)
+                elif key[0] == SENSOR:
+                    self._push(key, row, self._due_time(row.last_measurement, row.update_interval))
                 else:
-                    return next_controller, next_controller_time
-            elif next_sensor_time:
-                return next_sensor, next_sensor_time
-            elif next_controller_time:
-                return next_controller, next_controller_time
+                    self._push(key, row, self._due_time(row.last_run, row.update_interval))
+    
+    def _drop_instance(self, key: tuple):
+        """Release a driver instance so the next run builds one from the new config"""
+        instances = self.sensor_instances if key[0] == SENSOR else self.controller_instances
+        instance = instances.pop(key[1], None)
+        if instance and hasattr(instance, "close"):
+            try:
+                instance.close()
+            except Exception as e:
+                print(f"Error closing {key[0]} {key[1]}: {e}")
+    
+    def _execute(self, key: tuple, item: Any):
+        """Worker: run one item, then queue its next run"""
+        try:
+            if key[0] == SENSOR:
+                self._run_sensor(item)
             else:
-                return None, datetime.now()
+                self._run_controller(item)
+        finally:
+            with self._cond:
+                self._busy.discard(key)
+                # Invalidated while running: _reload_stale() queues it from the new row
+                if key not in self._stale:
+                    self._push(key, item, datetime.now() + timedelta(seconds=item.update_interval))
+                self._cond.notify_all()
     
     def _run_sensor(self, sensor: Sensor):
         """Run a sensor and record its measurements"""
@@ -162,7 +267,16 @@ class Scheduler:
                 print(f"Recorded {len(readings)} measurements from sensor {sensor.id} {sensor.name} : ")
                 
                 # Record the measurements
+                rows = []
                 for reading in readings:
+                    # Sample series go through the batched writer, not this transaction
+                    series = reading.get('series')
+                    if series is not None:
+                        self.writer.add(sensor.id, reading['type'], reading['unit'],
+                                        series['timestamp'], series['value'], series.get('raw_value'))
+                        print(f"\t{reading['type']}: {len(series['value'])} samples queued")
+                        continue
+                    
                     measurement = Measurement(
                         timestamp=datetime.now(),
                         measurement_type=reading['type'],
@@ -172,6 +286,12 @@ class Scheduler:
                         sensor_id=sensor.id
                     )
                     session.add(measurement)
+                    if measurement.value is not None:
+                        rows.append({
+                            'sensor_id': sensor.id, 'measurement_type': measurement.measurement_type,
+                            'timestamp': measurement.timestamp, 'value': measurement.value,
+                            'unit': measurement.unit
+                        })
 
                     print(f"\t{reading['type']}: {reading['value']} {reading['unit']} (raw: {reading.get('raw_value')})")
                 
@@ -181,6 +301,7 @@ class Scheduler:
                     db_sensor.last_measurement = datetime.now()
                     session.add(db_sensor)
                 
+                update_rollups(session.connection(), rows)
                 session.commit()
 
         except Exception as e:
@@ -27,13 +27,25 @@ class BaseSensor(ABC):
                     'type': MeasurementType,
                     'value': float,
                     'unit': str,
-                    'raw_value': float (optional)
+                    'raw_value': float (optional),
+                    'series': {                  (optional, high-rate sensors)
+                        'timestamp': [datetime, ...],
+                        'value': [float, ...],
+                        'raw_value': [float, ...]
+                    }
                 },
                 ...
             ]
+            
+            A reading with a series is stored as one row per sample through the
+            scheduler's batched writer, instead of as a single row.
         """
         pass
     
+    def close(self) -> None:
+        """Release the hardware, called before the sensor is rebuilt with a new config"""
+        pass
+    
     def apply_calibration(self, measurement_type: MeasurementType, raw_value: float) -> float:
         """Apply calibration to a raw sensor value
         
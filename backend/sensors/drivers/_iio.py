@@ -0,0 +1,100 @@
+import os
+import re
+
+# Root of the IIO devices in sysfs
+IIO_SYSFS_ROOT = "/sys/bus/iio/devices"
+
+
+class IIODevice:
+    """Minimal sysfs accessor for a Linux IIO device"""
+
+    def __init__(self, path):
+        """
+        Args:
+            path: sysfs directory of the device, e.g. /sys/bus/iio/devices/iio:device0
+        """
+        self.path = path
+        self.name = os.path.basename(path)
+
+    @classmethod
+    def find(cls, name, index=0):
+        """
+        Find an IIO device by driver name
+
+        Args:
+            name: Device name as reported by the `name` attribute (e.g. "cs1237")
+            index: Which one to return when several devices share that name
+
+        Returns:
+            IIODevice, or None if no such device is registered
+        """
+        if not os.path.isdir(IIO_SYSFS_ROOT):
+            return None
+
+        entries = [e for e in os.listdir(IIO_SYSFS_ROOT) if re.fullmatch(r"iio:device\d+", e)]
+        entries.sort(key=lambda e: int(e[len("iio:device"):]))
+
+        matches = []
+        for entry in entries:
+            path = os.path.join(IIO_SYSFS_ROOT, entry)
+            try:
+                with open(os.path.join(path, "name")) as f:
+                    if f.read().strip() == name:
+                        matches.append(path)
+            except OSError:
+                continue
+
+        if index >= len(matches):
+            return None
+        return cls(matches[index])
+
+    def has_attr(self, attr):
+        """Check whether the device exposes an attribute"""
+        return os.path.exists(os.path.join(self.path, attr))
+
+    def list_attrs(self, directory=""):
+        """List the attributes in a subdirectory of the device (e.g. scan_elements)"""
+        path = os.path.join(self.path, directory)
+        if not os.path.isdir(path):
+            return []
+        return sorted(os.listdir(path))
+
+    def read_attr(self, attr):
+        """Read an attribute as a stripped string"""
+        with open(os.path.join(self.path, attr)) as f:
+            return f.read().strip()
+
+    def read_int(self, attr):
+        """Read an integer attribute"""
+        return int(self.read_attr(attr))
+
+    def read_float(self, attr):
+        """Read a decimal attribute (scale, offset, ...)"""
+        return float(self.read_attr(attr))
+
+    def read_bytes(self, attr):
+        """
+        Read a binary attribute whole
+
+        The first read() asks for the whole file so the driver can return one snapshot; reads
+        continue until st_size bytes or EOF, since sysfs hands out at most a page per call.
+        """
+        fd = os.open(os.path.join(self.path, attr), os.O_RDONLY)
+        try:
+            size = os.fstat(fd).st_size or 65536
+            chunks = []
+            remaining = size
+            while remaining > 0:
+                chunk = os.read(fd, remaining)
+                if not chunk:
+                    break
+                chunks.append(chunk)
+                remaining -= len(chunk)
+            return b''.join(chunks)
+        finally:
+            os.close(fd)
+
+    def write_attr(self, attr, value):
+        """Write an attribute"""
+        with open(os.path.join(self.path, attr), "w") as f:
+            f.write(str(value))
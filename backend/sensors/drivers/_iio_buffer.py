@@ -0,0 +1,144 @@
+import os
+import re
+import threading
+import numpy as np
+
+# Scan element type as reported by scan_elements/*_type, e.g. "le:s24/32>>0"
+_SCAN_TYPE_RE = re.compile(r"(le|be):([su])(\d+)/(\d+)(?:X(\d+))?>>(\d+)")
+
+
+class IIOBufferReader:
+    """Background reader for the buffered interface (/dev/iio:deviceX) of an IIO device"""
+
+    def __init__(self, device, channel, timestamp=False, watermark=1280, length=None):
+        """
+        Args:
+            device: IIODevice to capture from
+            channel: Scan element to enable, e.g. "in_voltage0"
+            timestamp: Also capture in_timestamp
+            watermark: Scans per wakeup; the reader sleeps until that many are queued
+            length: Kernel buffer length in scans (default: 4 wakeups worth)
+        """
+        self.device = device
+        self.channel = channel
+        self.timestamp = timestamp
+        self.watermark = watermark
+        self.length = length or 4 * watermark
+
+        self._fd = None
+        self._dtype = None
+        self._fields = {}
+        self._batches = []
+        self._lock = threading.Lock()
+        self._running = False
+        self._thread = None
+
+    def _scan_dtype(self):
+        """Build the numpy record type of one scan from the enabled scan elements"""
+        elements = []
+        for name in [self.channel] + (["in_timestamp"] if self.timestamp else []):
+            index = self.device.read_int(f"scan_elements/{name}_index")
+            match = _SCAN_TYPE_RE.fullmatch(self.device.read_attr(f"scan_elements/{name}_type"))
+            if not match:
+                raise ValueError(f"Unsupported scan type for {name}")
+            endian, sign, bits, storage, repeat, shift = match.groups()
+            elements.append((index, name, endian, sign, int(bits), int(storage) // 8, int(shift)))
+
+        # Elements sit in index order, each aligned to its own size, the scan to the largest
+        names, formats, offsets = [], [], []
+        offset = 0
+        largest = max(e[5] for e in elements)
+        self._fields = {}
+        for _, name, endian, sign, bits, size, shift in sorted(elements):
+            offset = (offset + size - 1) // size * size
+            names.append(name)
+            formats.append(np.dtype(f"{'<' if endian == 'le' else '>'}{'i' if sign == 's' else 'u'}{size}"))
+            offsets.append(offset)
+            offset += size
+            self._fields[name] = (sign == 's', bits, shift)
+        itemsize = (offset + largest - 1) // largest * largest
+
+        return np.dtype({"names": names, "formats": formats, "offsets": offsets, "itemsize": itemsize})
+
+    def start(self):
+        """Configure and enable the kernel buffer, then start the reader thread"""
+        if self._running:
+            return
+
+        # The buffer must be disabled while it is reconfigured
+        self.device.write_attr("buffer/enable", 0)
+        # Enable exactly the elements _scan_dtype() lays out, whatever was left on before
+        wanted = {self.channel} | ({"in_timestamp"} if self.timestamp else set())
+        for attr in self.device.list_attrs("scan_elements"):
+            if attr.endswith("_en"):
+                enable = 1 if attr[: -len("_en")] in wanted else 0
+                self.device.write_attr(f"scan_elements/{attr}", enable)
+        self.device.write_attr("buffer/length", self.length)
+        self.device.write_attr("buffer/watermark", self.watermark)
+        self._dtype = self._scan_dtype()
+
+        self._fd = os.open(f"/dev/{self.device.name}", os.O_RDONLY)
+        self.device.write_attr("buffer/enable", 1)
+
+        self._running = True
+        self._thread = threading.Thread(target=self._read_loop)
+        self._thread.daemon = True
+        self._thread.start()
+        print(f"IIO buffered capture started on {self.device.name}")
+
+    def stop(self):
+        """Disable the kernel buffer and stop the reader thread"""
+        self._running = False
+        # Disabling the buffer wakes up a blocked read()
+        self.device.write_attr("buffer/enable", 0)
+        if self._thread:
+            self._thread.join(timeout=1.0)
+            self._thread = None
+        if self._fd is not None:
+            os.close(self._fd)
+            self._fd = None
+        print(f"IIO buffered capture stopped on {self.device.name}")
+
+    def _read_loop(self):
+        """Background thread: one blocking read() per watermark worth of scans"""
+        chunk = self.watermark * self._dtype.itemsize
+        while self._running:
+            try:
+                data = os.read(self._fd, chunk)
+            except OSError as e:
+                if self._running:
+                    print(f"IIO buffer read failed on {self.device.name}: {e}")
+                break
+            if not data:
+                continue
+
+            scans = np.frombuffer(data[: len(data) - len(data) % self._dtype.itemsize], dtype=self._dtype)
+            with self._lock:
+                self._batches.append(scans)
+                # Keep at most one kernel buffer worth if nobody drains
+                while sum(len(b) for b in self._batches) > self.length:
+                    self._batches.pop(0)
+
+    def drain(self):
+        """
+        Take every scan captured since the last call
+
+        Returns:
+            dict with one numpy array per enabled element: the channel values sign-extended
+            and shifted to their real bits, plus "in_timestamp" (ns) if enabled
+        """
+        with self._lock:
+            batches, self._batches = self._batches, []
+
+        scans = np.concatenate(batches) if batches else np.empty(0, dtype=self._dtype)
+        result = {}
+        for name in self._dtype.names:
+            signed, bits, shift = self._fields[name]
+            values = scans[name].astype(np.int64) >> shift
+            if bits < 64:
+                values &= (1 << bits) - 1
+                if signed:
+                    # Sign-extend the real bits out of the storage word
+                    values = (values ^ (1 << (bits - 1))) - (1 << (bits - 1))
+            result[name] = values
+        return result
@@ -20,6 +20,10 @@ class PHSensor(BaseSensor):
         self.adc.initialize()
         self.adc.start()
     
+    def close(self) -> None:
+        """Stop the acquisition thread and free the GPIOs"""
+        self.adc.close()
+    
     def read(self) -> List[Dict[str, Any]]:
         """Read temperature and humidity from the SHT41 sensor"""
         try:
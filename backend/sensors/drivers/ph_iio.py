@@ -0,0 +1,293 @@
+import struct
+from datetime import datetime
+from typing import Dict, List, Any, Optional, Tuple
+import numpy as np
+from models.base import MeasurementType
+from sensors.base import BaseSensor, SensorRegistry
+from ._iio import IIODevice
+
+# Same conversion as the bit-banging driver, so existing calibration points stay valid
+CS1237_VOLTS_PER_COUNT = 3.3 / 2.0 / 0x7FFFFF
+
+# Driver scale at PGA=1, in mV per count
+CS1237_SCALE_PGA1 = 3300 / 8388608
+
+# Fields of cs1237_snapshot, in order
+SNAPSHOT_FIELDS = ('seq', 'time_ns', 'raw', 'filtered', 'samples', 'mean',
+                   'win_count', 'win_min', 'win_max', 'win_mean', 'win_variance')
+SNAPSHOT_VOLTS = ('raw', 'filtered', 'mean', 'win_min', 'win_max', 'win_mean')
+
+# The driver's calibration maps the probe onto an ideal electrode, 0 mV at pH 7 and
+# 59.16 mV per pH (25 °C), so its processed value in mV gives pH with one multiply-add
+PH_NEUTRAL = 7.0
+PH_SLOPE_MV = 59.16
+
+class PHIIOSensor(BaseSensor):
+    """Driver for a pH probe on a CS1237 ADC, read through the cs1237 kernel driver"""
+    
+    def __init__(self, sensor_db):
+        super().__init__(sensor_db)
+        
+        iio_name = self.config.get('iio_name', 'cs1237')
+        iio_index = self.config.get('iio_index', 0)
+        
+        self.device = IIODevice.find(iio_name, iio_index)
+        self.adc = None
+        self.buffer = None
+        self.store_samples = False
+        # (seq, time_ns) of the last snapshot handed out
+        self._snapshot_last = None
+        # Calibration written to the driver, None when pH comes from apply_calibration()
+        self._driver_cal = None
+        
+        if self.device:
+            self._calibrate_driver()
+            # Single-shot reads: the chip sleeps between polls, each read averages a burst
+            if 'burst' in self.config and self.device.has_attr('cs1237_burst'):
+                self.device.write_attr('cs1237_burst', self.config['burst'])
+        
+        if self.device and self.config.get('buffered', False):
+            # Stream every conversion, waking up about once per second
+            from ._iio_buffer import IIOBufferReader
+            
+            watermark = self.config.get('buffer_watermark', self._scan_rate())
+            # Store every sample rather than one median per read
+            self.store_samples = self.config.get('store_samples', False)
+            self.buffer = IIOBufferReader(self.device, 'in_voltage0', timestamp=self.store_samples,
+                                          watermark=watermark)
+            self.buffer.start()
+            print(f"pH sensor streaming from IIO device {self.device.name}")
+        elif self.device:
+            print(f"pH sensor using IIO device {self.device.name}")
+        else:
+            # Kernel module not loaded, fall back to bit-banging from Python
+            print(f"IIO device {iio_name} not found, falling back to GPIO bit-banging")
+            from ._cs1237 import CS1237
+            
+            sck_pin = self.config.get('sck_pin', 11)
+            data_read_pin = self.config.get('data_read_pin', 18)
+            data_write_pin = self.config.get('data_write_pin', 13)
+            
+            self.adc = CS1237(sck_pin, data_read_pin, data_write_pin)
+            self.adc.initialize()
+            self.adc.start()
+    
+    def _scan_rate(self) -> int:
+        """Channel A scans pushed per second: the chip rate, decimated and shared with temperature"""
+        rate = self.device.read_int('sampling_frequency')
+        if self.device.has_attr('in_voltage0_oversampling_ratio'):
+            rate /= self.device.read_int('in_voltage0_oversampling_ratio')
+        if self.device.has_attr('cs1237_temp_interval'):
+            interval = self.device.read_int('cs1237_temp_interval')
+            if interval:
+                # One temperature conversion every `interval` channel A ones
+                rate = rate * interval / (interval + 1)
+        return max(int(rate), 1)
+    
+    def close(self) -> None:
+        """Stop streaming, or the bit-banging thread"""
+        if self.buffer:
+            self.buffer.stop()
+        if self.adc:
+            self.adc.close()
+    
+    def _calibration_line(self) -> Optional[Tuple[float, float]]:
+        """
+        Stored pH calibration as a line, pH = a + b * volts
+        
+        Returns:
+            (a, b), or None without calibration data or when the points share one voltage
+        """
+        cal = self.calibration_data.get(MeasurementType.PH.value)
+        if not cal:
+            return None
+        
+        points = cal.get('points', [])
+        if len(points) >= 2:
+            raws = [p['raw'] for p in points]
+            if min(raws) == max(raws):
+                return None
+            # Least squares, the same line as apply_calibration() for two points
+            b, a = np.polyfit(raws, [p['actual'] for p in points], 1)
+            return float(a), float(b)
+        if 'offset' in cal:
+            return float(cal['offset']), 1.0
+        if 'scale' in cal:
+            return 0.0, float(cal['scale'])
+        return None
+    
+    def _calibrate_driver(self) -> None:
+        """
+        Write the stored calibration to in_voltage0_calibbias/calibscale
+        
+        Runs once per instance; a recalibration rebuilds the sensor, so it runs again with the
+        new points. The correction lands on every sample in the kernel, pH is then its processed
+        value scaled to the ideal electrode. A falling slope is folded into the sign. When the
+        driver rejects the values (gain of 16 or more, bias out of range) they are reset, and
+        pH comes from apply_calibration() as without the driver.
+        """
+        if not self.device.has_attr('in_voltage0_calibscale'):
+            return
+        
+        line = self._calibration_line()
+        scale_mv = self.device.read_float('in_voltage0_scale')
+        offset = self.device.read_int('in_voltage0_offset') if self.device.has_attr('in_voltage0_offset') else 0
+        bias, gain, sign = 0, 1.0, 1.0
+        if line:
+            a, b = line
+            sign = 1.0 if b > 0 else -1.0
+            # sign * (counts + offset) * scale_mv / PH_SLOPE_MV == b * volts, + PH_NEUTRAL == a
+            gain = abs(b) * self._volts_per_count() * PH_SLOPE_MV / scale_mv
+            bias = round(((a - PH_NEUTRAL) * sign * PH_SLOPE_MV / scale_mv - offset) / gain) if gain else 0
+        
+        try:
+            self.device.write_attr('in_voltage0_calibbias', bias)
+            self.device.write_attr('in_voltage0_calibscale', f'{gain:.6f}')
+        except OSError as e:
+            print(f"pH calibration not accepted by the driver ({e}), applying it per read")
+            try:
+                self.device.write_attr('in_voltage0_calibbias', 0)
+                self.device.write_attr('in_voltage0_calibscale', '1.000000')
+            except OSError:
+                pass
+            return
+        
+        if line:
+            self._driver_cal = {'bias': bias, 'gain': float(f'{gain:.6f}'), 'sign': sign,
+                                'scale_mv': scale_mv, 'offset': offset}
+    
+    def _volts_per_count(self) -> float:
+        """Conversion for the driver's counts, which follow its gain (or autorange's fixed scale)"""
+        if not self.device.has_attr('in_voltage0_scale'):
+            return CS1237_VOLTS_PER_COUNT
+        # sysfs rounds the scale to 9 decimals, the gain itself is an integer
+        gain = round(CS1237_SCALE_PGA1 / self.device.read_float('in_voltage0_scale'))
+        return CS1237_VOLTS_PER_COUNT / max(gain, 1)
+    
+    def _to_volts(self, counts):
+        """Probe voltage of driver counts (scalar or array) before its correction, as calibration points use"""
+        if self._driver_cal:
+            counts = counts / self._driver_cal['gain'] - self._driver_cal['bias']
+        return counts * self._volts_per_count()
+    
+    def _to_ph(self, counts):
+        """pH of driver counts (scalar or array)"""
+        cal = self._driver_cal
+        if cal:
+            # The driver's processed value, (raw + offset) * scale in mV
+            millivolts = (counts + cal['offset']) * cal['scale_mv']
+            return PH_NEUTRAL + cal['sign'] * millivolts / PH_SLOPE_MV
+        
+        volts = self._to_volts(counts)
+        if np.ndim(volts):
+            return np.array([self.apply_calibration(MeasurementType.PH, v) for v in volts.tolist()])
+        return self.apply_calibration(MeasurementType.PH, volts)
+    
+    def _read_counts(self) -> float:
+        """Read the filtered channel A counts"""
+        if self.buffer:
+            # Median over everything streamed since the last read
+            samples = self.buffer.drain()['in_voltage0']
+            if len(samples):
+                return float(np.median(samples))
+        
+        # Median + moving average are applied by the driver
+        return float(self.device.read_int('in_voltage0_filtered_raw'))
+    
+    def read_history(self) -> List[float]:
+        """
+        Last samples kept by the driver, oldest first, in volts
+        
+        Returns:
+            Up to `chipsea,buffer-size` voltages, empty when bit-banging
+        """
+        if self.adc or not self.device.has_attr('cs1237_history'):
+            return []
+        
+        data = self.device.read_bytes('cs1237_history')
+        head, count, size, _total = struct.unpack_from('=4I', data)
+        samples = struct.unpack_from(f'={size}i', data, 16)
+        
+        # Ring order: once full the oldest sample sits at head
+        ordered = samples[head:] + samples[:head] if count == size else samples[:count]
+        return self._to_volts(np.array(ordered, dtype=float)).tolist()
+    
+    def read_snapshot(self) -> Dict[str, Any]:
+        """
+        Latest sample and its statistics, all from the same conversion
+        
+        Returns:
+            SNAPSHOT_FIELDS as a dict, sample values in volts (variance in V²),
+            empty when bit-banging, with a driver without cs1237_snapshot, or when
+            no new sample arrived since the previous call, so callers fall back to read()
+        """
+        if self.adc or not self.device.has_attr('cs1237_snapshot'):
+            return {}
+        
+        snapshot = dict(zip(SNAPSHOT_FIELDS, map(int, self.device.read_attr('cs1237_snapshot').split())))
+        # The driver never waits for a conversion: same seq and time means a stale record
+        current = (snapshot['seq'], snapshot['time_ns'])
+        if current == self._snapshot_last or not snapshot['seq']:
+            return {}
+        self._snapshot_last = current
+        
+        for key in SNAPSHOT_VOLTS:
+            snapshot[key] = float(self._to_volts(snapshot[key]))
+        # A spread only sees the gains, not the offsets
+        volts_per_count = self._to_volts(1.0) - self._to_volts(0.0)
+        snapshot['win_variance'] *= volts_per_count ** 2
+        return snapshot
+    
+    def _read_series(self) -> List[Dict[str, Any]]:
+        """Every sample streamed since the last read, plus their median as the value"""
+        scans = self.buffer.drain()
+        if not len(scans['in_voltage0']):
+            return []
+        
+        counts = scans['in_voltage0'].astype(float)
+        median = float(np.median(counts))
+        return [
+            {
+                'type': MeasurementType.PH,
+                'value': float(self._to_ph(median)),
+                'unit': '',
+                'raw_value': float(self._to_volts(median)),
+                'series': {
+                    # IIO timestamps are CLOCK_REALTIME ns
+                    'timestamp': [datetime.fromtimestamp(ns / 1e9) for ns in scans['in_timestamp'].tolist()],
+                    'value': self._to_ph(counts).tolist(),
+                    'raw_value': self._to_volts(counts).tolist()
+                }
+            }
+        ]
+    
+    def read(self) -> List[Dict[str, Any]]:
+        """Read pH from the CS1237 ADC"""
+        try:
+            if self.buffer and self.store_samples:
+                return self._read_series()
+            
+            if self.adc:
+                # Bit-banging: no driver to calibrate, apply it here
+                voltage = self.adc.get_averaged_data()
+                calibrated_ph = self.apply_calibration(MeasurementType.PH, voltage)
+            else:
+                counts = self._read_counts()
+                voltage = float(self._to_volts(counts))
+                calibrated_ph = float(self._to_ph(counts))
+            
+            return [
+                {
+                    'type': MeasurementType.PH,
+                    'value': calibrated_ph,
+                    'unit': '',
+                    'raw_value': voltage
+                }
+            ]
+        except Exception as e:
+            # Log the error
+            print(f"Error reading pH IIO sensor: {e}")
+            return []
+
+# Register the driver
+SensorRegistry.register('ph_iio', PHIIOSensor)
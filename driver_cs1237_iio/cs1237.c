@@ -12,20 +12,47 @@
 #include <linux/platform_device.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
 #include <linux/err.h>
 #include <linux/spi/spi.h>
 #include <linux/gpio/consumer.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/of_gpio.h>
+#include <linux/pm_runtime.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
 #include <linux/iio/buffer.h>
 #include <linux/iio/trigger.h>
 #include <linux/iio/triggered_buffer.h>
 #include <linux/iio/trigger_consumer.h>
+#include <linux/iio/events.h>
+#include <linux/interrupt.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include <linux/sched/types.h>
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
 #include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/bitfield.h>
+#include <linux/math64.h>
+#include <linux/units.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#ifdef CS1237_BENCH
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched/signal.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#endif
 
 /* CS1237 Configuration Constants */
 #define CS1237_PGA_1             0
@@ -44,6 +71,35 @@
 #define CS1237_REFO_DISABLE      0
 #define CS1237_REFO_ENABLE       1
 
+/* Filter limits: median window must be odd */
+#define CS1237_MEDIAN_MAX        31
+#define CS1237_AVERAGE_MAX       256
+#define CS1237_MEDIAN_DEFAULT    5
+
+/* Timing histograms: 4 buckets per power of two nanoseconds, up to ~18 min */
+#define CS1237_HIST_SUB_BITS     2
+#define CS1237_HIST_BUCKETS      (40 << CS1237_HIST_SUB_BITS)
+
+/* Conversion periods without a read before the chip is reset */
+#define CS1237_STUCK_PERIODS     10
+#define CS1237_STUCK_MIN_MS      1000
+
+/* Largest channel A oversampling ratio, itself capped at the ODR */
+#define CS1237_OSR_MAX           1024
+
+/* Default capture ring length in records, see cs1237_capture_open() */
+#define CS1237_CAPTURE_RECORDS   65536
+#define CS1237_CAPTURE_MAGIC     0x43534331 /* "CSC1" */
+
+/* Idle time before the chip is powered down, see runtime PM */
+#define CS1237_AUTOSUSPEND_MS    10000
+
+/* Longest single-shot burst, in channel A samples */
+#define CS1237_BURST_MAX         256
+
+/* Autorange: settled samples below half scale at a higher gain before it is used */
+#define CS1237_RANGE_HOLD        16
+
 /* Register commands */
 #define CS1237_CMD_WRITE_REG     0x65
 #define CS1237_CMD_READ_REG      0x56
@@ -51,15 +107,183 @@
 /* Sample rates in Hz */
 static const int cs1237_sample_rates[] = {10, 40, 640, 1280};
 
+/* PGA gains, and the shift from each to the PGA=128 scale used by autorange */
+static const int cs1237_pga_gains[] = {1, 2, 64, 128};
+static const int cs1237_pga_shift[] = {7, 6, 1, 0};
+
+/*
+ * Conversions discarded after the input, gain or rate changes, per ODR.
+ * The digital filter needs more output periods to settle at the higher
+ * rates, while at 10 Hz every discarded conversion costs 100 ms.
+ */
+static const int cs1237_settle_samples[] = {2, 3, 4, 4};
+
+/*
+ * Per-sample metadata, the in_count0 scan element: conversion sequence
+ * number (reads plus missed conversions, so gaps show what was not pushed),
+ * the input, gain and rate it was converted with, and CS1237_FLAG_*
+ */
+#define CS1237_META_SEQ          GENMASK(15, 0)
+#define CS1237_META_PGA          GENMASK(17, 16)
+#define CS1237_META_SPEED        GENMASK(19, 18)
+#define CS1237_META_INPUT        BIT(20)
+#define CS1237_META_FLAGS        GENMASK(22, 21)
+
+/* First sample after discarded settling conversions (switch, reset) */
+#define CS1237_FLAG_SETTLED      BIT(0)
+/* DOUT needed extra clocks since the previous sample */
+#define CS1237_FLAG_RESYNC       BIT(1)
+
+/*
+ * One acquisition thread serves every CS1237 in the system: the DRDY IRQ of
+ * each chip queues that chip's work item on it, so N chips cost one thread
+ * and a work item each rather than N threads.
+ */
+static struct kthread_worker *cs1237_worker;
+
+#ifdef CS1237_BENCH
+/* debugfs cs1237/, one directory per IIO device below it */
+static struct dentry *cs1237_debugfs;
+#endif
+
+static int acq_priority = MAX_RT_PRIO / 2;
+module_param(acq_priority, int, 0444);
+MODULE_PARM_DESC(acq_priority, "SCHED_FIFO priority of the acquisition thread, 1-99 (0: SCHED_NORMAL)");
+
+static int acq_cpu = -1;
+module_param(acq_cpu, int, 0444);
+MODULE_PARM_DESC(acq_cpu, "CPU the acquisition thread is pinned to (-1: any)");
+
+struct cs1237_state;
+
+/*
+ * Monotonic deque over the ring: positions still in the window whose
+ * values are strictly better (lower for min, higher for max) than all
+ * later ones. The front is the window extreme.
+ */
+struct cs1237_deque_entry {
+    s32 value;
+    u32 pos;
+};
+
+struct cs1237_deque {
+    struct cs1237_deque_entry *entries;
+    u32 head;
+    u32 len;
+};
+
+/*
+ * Layout of the capture device mapping: this header in the first page,
+ * then a ring of records at data_offset. The kernel owns head, the reader
+ * owns tail and watermark. Counters are free running u32, so head - tail
+ * is the backlog even across wrap; a backlog above records means the
+ * reader was overrun.
+ */
+struct cs1237_capture_header {
+    u32 magic;
+    u32 record_size;
+    u32 records;
+    u32 data_offset;
+    u32 head;
+    u32 tail;
+    u32 watermark;
+    u32 reserved;
+};
+
+struct cs1237_capture_record {
+    s32 value;
+    u8 channel;
+    u8 pga;
+    u8 speed;
+    u8 flags;
+    s64 timestamp;
+};
+
+/*
+ * Header of the cs1237_history binary attribute, followed by buffer_size
+ * s32 samples in ring order. Samples are oldest first from index head
+ * once count == size, or from index 0 before that. total counts every
+ * sample ever stored, so a reader can tell how many it missed.
+ */
+struct cs1237_history_header {
+    u32 head;
+    u32 count;
+    u32 size;
+    u32 total;
+};
+
+/* Longest sample ring whose cs1237_history still fits in one page */
+#define CS1237_BUFFER_MAX \
+    ((PAGE_SIZE - sizeof(struct cs1237_history_header)) / sizeof(s32))
+
+/* Distribution of a duration, in nanoseconds */
+struct cs1237_timing {
+    u64 min;
+    u64 max;
+    u64 sum;
+    u32 count;
+    u32 hist[CS1237_HIST_BUCKETS];
+};
+
+#ifdef CS1237_BENCH
+/* Last transport benchmark run, under lock */
+struct cs1237_bench {
+    int op;
+    u64 wall_ns;
+    u64 cpu_ns;
+    struct cs1237_timing xfer;
+};
+#endif
+
+/* Bus access: clocking a data read or a config access through the chip */
+struct cs1237_transport_ops {
+    const char *name;
+    int (*read_sample)(struct cs1237_state *state, u32 *raw);
+    /* raw, if not NULL, receives the conversion clocked out first */
+    int (*config_xfer)(struct cs1237_state *state, u8 cmd, u8 *config_byte, u32 *raw);
+    /* Drive SCK directly, for power up/down; NULL if the bus owns it */
+    void (*set_sck)(struct cs1237_state *state, int value);
+};
+
+#ifdef CS1237_KUNIT
+/* SCK, DIN and DOUT line accesses, replaced by the emulated chip of the tests */
+struct cs1237_line_ops {
+    void (*set_sck)(struct cs1237_state *state, int value);
+    void (*set_din)(struct cs1237_state *state, int value);
+    int (*get_dout)(struct cs1237_state *state);
+};
+#endif
+
 struct cs1237_state {
     struct device *dev;
+    struct iio_dev *indio_dev;
+    /* Serialises configuration changes, never taken by the acquisition path */
     struct mutex lock;
-    struct task_struct *conv_task;
+    int irq;
+    /* No usable DOUT IRQ: poll_timer stands in for the DRDY edge */
+    bool poll;
+    struct hrtimer poll_timer;
+    spinlock_t poll_lock;
+    unsigned int poll_depth;
+    ktime_t poll_expires;
+    bool enabled;
+    bool suspended;
     bool running;
+    struct delayed_work watchdog;
+    unsigned int watchdog_xfers;
+    struct iio_trigger *trig;
+    struct kthread_work acq_work;
     
+    const struct cs1237_transport_ops *ops;
     struct gpio_desc *sck_gpio;
     struct gpio_desc *dout_gpio;
     struct gpio_desc *din_gpio;
+    /* Optional SCK + DIN array, for single-write clock and data edges */
+    struct gpio_descs *sck_din;
+    unsigned int sck_delay_ns;
+    struct spi_device *spi;
+    u8 spi_read_bpw;
+    u8 spi_config_bpw;
     
     /* Configuration */
     int pga;
@@ -67,68 +291,467 @@ struct cs1237_state {
     int channel;
     int refo;
     
-    /* Data */
-    s32 raw_data;
+    /*
+     * Everything below up to the statistics is written only by the
+     * acquisition work, under sample_lock. Readers use the seqlock read side and
+     * retry, so they can never stall acquisition.
+     */
+    seqlock_t sample_lock;
+    wait_queue_head_t sample_wq;
+    
+    /* Data: latest sample of each input and how many were read */
+    s32 chan_data[2];
+    u64 chan_time_ns[2];
+    unsigned int chan_count[2];
     int raw_counter;
-    bool data_ready;
+    
+    /*
+     * Input multiplexing, owned by the acquisition work: one temperature
+     * conversion every temp_interval channel A conversions (0 = off), and
+     * the number of conversions still to discard after a switch.
+     */
+    int temp_interval;
+    /*
+     * One-point temperature calibration, under sample_lock: a raw reading
+     * taken at gain temp_cal_pga and the temperature it was taken at.
+     * temp_cal_raw is 0 while uncalibrated.
+     */
+    s32 temp_cal_raw;
+    int temp_cal_pga;
+    int temp_cal_mdegc;
+    int mux_count;
+    int settle_count;
+    int buffer_channel;
+    /* CS1237_FLAG_* gathered for the next sample that is kept */
+    u8 sample_flags;
+    
+    /*
+     * Single-shot mode: raw and filtered reads wake the chip for burst
+     * channel A samples (0 = continuous). burst_lock serialises them; the
+     * reader arms burst_target, the acquisition work fills sum and count.
+     */
+    int burst;
+    struct mutex burst_lock;
+    unsigned int burst_target;
+    unsigned int burst_count;
+    s64 burst_sum;
+    
+    /*
+     * Rate and gain change handed to the acquisition work while it runs,
+     * as config byte bits 0-3 (-1 = none), and a count of applied changes
+     */
+    atomic_t pending_config;
+    unsigned int config_seq;
+    
+    /*
+     * Channel A decimation: osr conversions are averaged into one output
+     * sample. The accumulator is owned by the acquisition work.
+     */
+    int osr;
+    int dec_osr;
+    int dec_count;
+    s64 dec_sum;
+    
+    /*
+     * Autorange: the acquisition work picks the gain (range_pga) and
+     * normalises channel A to the PGA=128 scale; range_peak is the largest
+     * magnitude seen over the range_hold samples counted towards a step up
+     */
+    bool autorange;
+    int range_pga;
+    int range_hold;
+    u32 range_peak;
+    
+    /*
+     * Channel A calibration, applied to every sample before it is stored:
+     * (raw + calibbias) * calibscale, calibscale in millionths. offset is
+     * only reported, for consumers computing (raw + offset) * scale.
+     */
+    int calibbias;
+    int calibscale;
+    int offset;
     
     /* Buffer for continuous sampling */
     s32 *sample_buffer;
     int buffer_head;
     int buffer_size;
+    int buffer_count;
+    u32 buffer_total;
+    struct bin_attribute history_attr;
+    
+    /*
+     * Statistics over the ring, updated in O(1) per sample. Exact integer
+     * sums instead of a running Welford mean, so removing the sample that
+     * leaves the window never accumulates rounding error.
+     */
+    s64 win_sum;
+    u64 win_sumsq;
+    struct cs1237_deque win_min;
+    struct cs1237_deque win_max;
+    
+    /*
+     * Threshold events on the filtered value, index 0 rising and 1
+     * falling. ev_armed is owned by the acquisition work: an event fires
+     * once, then rearms after crossing back past the hysteresis band.
+     */
+    bool ev_enabled[2];
+    int ev_thresh[2];
+    int ev_hyst[2];
+    bool ev_armed[2];
+    
+    /*
+     * Capture device: the ring (capture_map) is only allocated while the
+     * device is open. capture_ring is the same ring as seen by the
+     * acquisition work, set under the mutex. capture_dead, also under the
+     * mutex, is set on remove: an open file then keeps the state alive
+     * through its iio_dev reference but no longer touches the chip.
+     */
+    struct miscdevice capture_misc;
+    char capture_name[24];
+    u32 capture_records;
+    struct cs1237_capture_header *capture_map;
+    struct cs1237_capture_header *capture_ring;
+    bool capture_dead;
+    u32 capture_head;
+    wait_queue_head_t capture_wq;
+    
+    /* Never reset, readers difference their own snapshots */
+    u64 total_count;
+    s64 total_sum;
     
     /* For statistics */
     s64 sum;
     int samples_count;
+    
+    /*
+     * Channel A filter: median of the last median_window samples, kept
+     * sorted incrementally, followed by a boxcar average of the last
+     * average_window medians.
+     */
+    int median_window;
+    int median_head;
+    int median_count;
+    s32 median_hist[CS1237_MEDIAN_MAX];
+    s32 median_sorted[CS1237_MEDIAN_MAX];
+    int average_window;
+    int average_head;
+    int average_count;
+    s64 average_sum;
+    s32 average_hist[CS1237_AVERAGE_MAX];
+    s32 filtered;
+    
+    /*
+     * Timing: DRDY edge (ktime_get_ns) of the conversion being read, edge
+     * to transaction start, transaction length and DRDY to DRDY interval
+     */
+    u64 drdy_ns;
+    u64 last_drdy_ns;
+    struct cs1237_timing latency;
+    struct cs1237_timing xfer_time;
+    struct cs1237_timing interval;
+    
+    /*
+     * Error counters, written by the acquisition work only: conversions
+     * lost, reads started after the next conversion was due, reads that
+     * needed extra clocks, and resets after DOUT stopped toggling
+     */
+    unsigned int xfers;
+    unsigned int missed;
+    unsigned int overruns;
+    unsigned int resyncs;
+    unsigned int stuck_resets;
+    
+    /* Buffered mode: DRDY edge time and the scan handed to the IIO buffer */
+    s64 drdy_timestamp;
+    struct {
+        s32 data;
+        u32 meta;
+        s64 timestamp __aligned(8);
+    } scan;
+    
+    /* SPI transfer buffers, one byte per clock at most */
+    u8 spi_tx[48] __aligned(IIO_DMA_MINALIGN);
+    u8 spi_rx[48];
+    
+#ifdef CS1237_BENCH
+    struct dentry *debugfs;
+    struct cs1237_bench bench;
+#endif
+#ifdef CS1237_KUNIT
+    const struct cs1237_line_ops *lines;
+#endif
+};
+
+static unsigned long cs1237_sample_timeout(struct cs1237_state *state);
+static int cs1237_read_burst(struct iio_dev *indio_dev, int burst, int *val);
+
+/* Readers hold the chip runtime active; the last one out starts autosuspend */
+static int cs1237_pm_get(struct cs1237_state *state)
+{
+    return pm_runtime_resume_and_get(state->dev);
+}
+
+static void cs1237_pm_put(struct cs1237_state *state)
+{
+    pm_runtime_mark_last_busy(state->dev);
+    pm_runtime_put_autosuspend(state->dev);
+}
+
+static int cs1237_filter_count(struct cs1237_state *state)
+{
+    unsigned int seq;
+    int count;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        count = state->average_count;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return count;
+}
+
+static ssize_t cs1237_filtered_raw_read(struct iio_dev *indio_dev, uintptr_t private,
+                                       const struct iio_chan_spec *chan, char *buf)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    unsigned int seq;
+    s32 filtered;
+    int count, burst;
+    int ret;
+    
+    /* Single-shot: the burst average stands in for the filter */
+    burst = READ_ONCE(state->burst);
+    if (burst) {
+        ret = cs1237_read_burst(indio_dev, burst, &filtered);
+        if (ret)
+            return ret;
+        return sysfs_emit(buf, "%d\n", filtered);
+    }
+    
+    ret = cs1237_pm_get(state);
+    if (ret)
+        return ret;
+    
+    /* The filter restarts on resume, wait for its first output */
+    wait_event_timeout(state->sample_wq, cs1237_filter_count(state),
+                       cs1237_sample_timeout(state));
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        count = state->average_count;
+        filtered = state->filtered;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    cs1237_pm_put(state);
+    
+    if (!count)
+        return -EBUSY;
+    
+    return sysfs_emit(buf, "%d\n", filtered);
+}
+
+static const struct iio_chan_spec_ext_info cs1237_voltage_ext_info[] = {
+    {
+        .name = "filtered_raw",
+        .shared = IIO_SEPARATE,
+        .read = cs1237_filtered_raw_read,
+    },
+    { }
 };
 
 /* IIO channel specification */
-static const struct iio_chan_spec cs1237_channels[] = {
+/* Crossings of the filtered value, see cs1237_check_events() */
+static const struct iio_event_spec cs1237_voltage_events[] = {
     {
-        .type = IIO_VOLTAGE,
-        .indexed = 1,
-        .channel = 0,
-        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
-                             BIT(IIO_CHAN_INFO_SCALE),
-        .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SAMP_FREQ),
-        .scan_index = 0,
-        .scan_type = {
-            .sign = 's',
-            .realbits = 24,
-            .storagebits = 32,
-            .endianness = IIO_CPU,
-        },
+        .type = IIO_EV_TYPE_THRESH,
+        .dir = IIO_EV_DIR_RISING,
+        .mask_separate = BIT(IIO_EV_INFO_VALUE) |
+                         BIT(IIO_EV_INFO_HYSTERESIS) |
+                         BIT(IIO_EV_INFO_ENABLE),
     },
     {
-        .type = IIO_TEMP,
-        .indexed = 1,
-        .channel = 1,
-        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
-                             BIT(IIO_CHAN_INFO_SCALE),
-        .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SAMP_FREQ),
-        .scan_index = 1,
-        .scan_type = {
-            .sign = 's',
-            .realbits = 24,
-            .storagebits = 32,
-            .endianness = IIO_CPU,
-        },
+        .type = IIO_EV_TYPE_THRESH,
+        .dir = IIO_EV_DIR_FALLING,
+        .mask_separate = BIT(IIO_EV_INFO_VALUE) |
+                         BIT(IIO_EV_INFO_HYSTERESIS) |
+                         BIT(IIO_EV_INFO_ENABLE),
     },
 };
 
+#define CS1237_VOLTAGE_CHANNEL(_bits) {                               \
+        .type = IIO_VOLTAGE,                                            \
+        .indexed = 1,                                                   \
+        .channel = 0,                                                   \
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |                  \
+                             BIT(IIO_CHAN_INFO_PROCESSED) |             \
+                             BIT(IIO_CHAN_INFO_SCALE) |                 \
+                             BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO) |    \
+                             BIT(IIO_CHAN_INFO_CALIBBIAS) |             \
+                             BIT(IIO_CHAN_INFO_CALIBSCALE) |            \
+                             BIT(IIO_CHAN_INFO_OFFSET),                 \
+        .info_mask_separate_available = BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO), \
+        .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SAMP_FREQ),       \
+        .info_mask_shared_by_type_available = BIT(IIO_CHAN_INFO_SAMP_FREQ), \
+        .ext_info = cs1237_voltage_ext_info,                            \
+        .event_spec = cs1237_voltage_events,                            \
+        .num_event_specs = ARRAY_SIZE(cs1237_voltage_events),           \
+        .scan_index = 0,                                                \
+        .scan_type = {                                                  \
+            .sign = 's',                                                \
+            .realbits = (_bits),                                        \
+            .storagebits = 32,                                          \
+            .endianness = IIO_CPU,                                      \
+        },                                                              \
+    }
+
+#define CS1237_TEMP_CHANNEL {                                           \
+        .type = IIO_TEMP,                                               \
+        .indexed = 1,                                                   \
+        .channel = 1,                                                   \
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |                  \
+                             BIT(IIO_CHAN_INFO_PROCESSED) |             \
+                             BIT(IIO_CHAN_INFO_SCALE),                  \
+        .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SAMP_FREQ),       \
+        .info_mask_shared_by_type_available = BIT(IIO_CHAN_INFO_SAMP_FREQ), \
+        .scan_index = 1,                                                \
+        .scan_type = {                                                  \
+            .sign = 's',                                                \
+            .realbits = 24,                                             \
+            .storagebits = 32,                                          \
+            .endianness = IIO_CPU,                                      \
+        },                                                              \
+    }
+
+/* Buffer only: CS1237_META_* of the sample in the same scan */
+#define CS1237_META_CHANNEL {                                           \
+        .type = IIO_COUNT,                                              \
+        .indexed = 1,                                                   \
+        .channel = 0,                                                   \
+        .scan_index = 2,                                                \
+        .scan_type = {                                                  \
+            .sign = 'u',                                                \
+            .realbits = 32,                                             \
+            .storagebits = 32,                                          \
+            .endianness = IIO_CPU,                                      \
+        },                                                              \
+    }
+
+static const struct iio_chan_spec cs1237_channels[] = {
+    CS1237_VOLTAGE_CHANNEL(24),
+    CS1237_TEMP_CHANNEL,
+    CS1237_META_CHANNEL,
+    IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+/* Autorange: channel A is normalised to the PGA=128 scale, 24 + 7 bits */
+static const struct iio_chan_spec cs1237_autorange_channels[] = {
+    CS1237_VOLTAGE_CHANNEL(31),
+    CS1237_TEMP_CHANNEL,
+    CS1237_META_CHANNEL,
+    IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+/*
+ * Only one ADC input is converted at a time, so only one can be buffered,
+ * with or without its metadata. Either way a scan is laid out like
+ * state->scan.
+ */
+static const unsigned long cs1237_scan_masks[] = {
+    BIT(0),
+    BIT(0) | BIT(2),
+    BIT(1),
+    BIT(1) | BIT(2),
+    0
+};
+
+/*
+ * Both transports clock whole transactions: a data read is 24 data bits plus
+ * 3 trailing clocks, a config access is 45 clocks (24 data bits, status,
+ * direction switches, 7 command bits, 8 register bits).
+ */
+#define CS1237_READ_CLOCKS       27
+#define CS1237_CONFIG_CLOCKS     45
+
+/*
+ * SCK timing limits used to size the bit-bang half period: minimum SCK
+ * high/low time, and the delay from the SCK rising edge until DOUT is valid.
+ * DIN is latched on the falling edge, so it may change with the rising edge.
+ */
+#define CS1237_T_SCK_MIN_NS      200
+#define CS1237_T_DOUT_VALID_NS   100
+#define CS1237_T_MARGIN_NS       50
+
+/* Line accesses of both transports, straight to gpiolib outside the tests */
+static inline void cs1237_sck_write(struct cs1237_state *state, int value)
+{
+#ifdef CS1237_KUNIT
+    if (state->lines) {
+        state->lines->set_sck(state, value);
+        return;
+    }
+#endif
+    gpiod_set_value(state->sck_gpio, value);
+}
+
+static inline void cs1237_din_write(struct cs1237_state *state, int value)
+{
+#ifdef CS1237_KUNIT
+    if (state->lines) {
+        state->lines->set_din(state, value);
+        return;
+    }
+#endif
+    gpiod_set_value(state->din_gpio, value);
+}
+
+static inline int cs1237_dout_read(struct cs1237_state *state)
+{
+#ifdef CS1237_KUNIT
+    if (state->lines)
+        return state->lines->get_dout(state);
+#endif
+    return gpiod_get_value(state->dout_gpio);
+}
+
+/* Wait out the remainder of a half period once the GPIO write returned */
+static inline void cs1237_sck_delay(struct cs1237_state *state)
+{
+    if (state->sck_delay_ns)
+        ndelay(state->sck_delay_ns);
+}
+
 static void cs1237_pulse_clock(struct cs1237_state *state)
 {
-    gpiod_set_value(state->sck_gpio, 1);
-    ndelay(500); /* 500ns delay - adjust as needed */
-    gpiod_set_value(state->sck_gpio, 0);
-    ndelay(500); /* 500ns delay - adjust as needed */
+    cs1237_sck_write(state, 1);
+    cs1237_sck_delay(state);
+    cs1237_sck_write(state, 0);
+    cs1237_sck_delay(state);
+}
+
+/* One SCK pulse with DIN driven to value, in a single write if batched */
+static void cs1237_pulse_clock_din(struct cs1237_state *state, int value)
+{
+    unsigned long values;
+    
+    if (!state->sck_din) {
+        cs1237_din_write(state, value);
+        cs1237_pulse_clock(state);
+        return;
+    }
+    
+    /* desc[0] is SCK, desc[1] is DIN */
+    values = BIT(0) | (value ? BIT(1) : 0);
+    gpiod_set_array_value(2, state->sck_din->desc, state->sck_din->info, &values);
+    cs1237_sck_delay(state);
+    cs1237_sck_write(state, 0);
+    cs1237_sck_delay(state);
 }
 
 static bool cs1237_wait_data_ready(struct cs1237_state *state, unsigned int timeout_ms)
 {
     unsigned long timeout = jiffies + msecs_to_jiffies(timeout_ms);
     
-    while (gpiod_get_value(state->dout_gpio) == 1) {
+    while (cs1237_dout_read(state) == 1) {
         if (time_after(jiffies, timeout))
             return false;
         usleep_range(100, 200);
@@ -137,71 +760,62 @@ static bool cs1237_wait_data_ready(struct cs1237_state *state, unsigned int time
     return true;
 }
 
-static int cs1237_write_config(struct cs1237_state *state, u8 config_byte)
+static int cs1237_gpio_read_sample(struct cs1237_state *state, u32 *raw)
 {
     int i;
+    u32 raw_data = 0;
     
-    /* Wait for data ready (DOUT goes low) */
-    if (!cs1237_wait_data_ready(state, 500)) {
-        dev_err(state->dev, "Timeout waiting for DOUT to go low during config write\n");
-        return -ETIMEDOUT;
-    }
-    
-    /* Read 24 bits (discard) */
-    for (i = 0; i < 24; i++)
-        cs1237_pulse_clock(state);
-    
-    /* 25th to 26th SCLKs - read register operation status */
-    for (i = 0; i < 2; i++)
-        cs1237_pulse_clock(state);
+    /* Keep data_write_pin low for reading */
+    cs1237_din_write(state, 0);
     
-    /* 27th SCLK - pulls DRDY/DOUT high */
-    cs1237_pulse_clock(state);
+    /* Read 24 bits */
+    for (i = 0; i < 24; i++) {
+        cs1237_sck_write(state, 1);
+        cs1237_sck_delay(state);
+        
+        raw_data = (raw_data << 1) | cs1237_dout_read(state);
+        
+        cs1237_sck_write(state, 0);
+        cs1237_sck_delay(state);
+    }
     
-    /* 28th to 29th SCLK - switch DRDY/DOUT to input */
-    for (i = 0; i < 2; i++)
+    /* Additional clock cycles (25-27) to complete the reading */
+    for (i = 0; i < 3; i++)
         cs1237_pulse_clock(state);
     
-    /* 30th to 36th SCLK - input register command word (7 bits) */
-    /* Send write command (0x65 = 0b01100101) */
-    for (i = 0; i < 7; i++) {
-        /* Set data write pin before clock goes high */
-        /* Note: The pin is inverted in hardware, so we invert the bit */
-        gpiod_set_value(state->din_gpio, !((CS1237_CMD_WRITE_REG >> (6 - i)) & 0x01));
+    /* Make sure DOUT goes high again - send a few clock pulses if needed */
+    for (i = 0; i < 5; i++) {
+        if (cs1237_dout_read(state))
+            break;
         cs1237_pulse_clock(state);
     }
-    
-    /* 37th SCLK - switch direction (for write, DRDY/DOUT remains input) */
-    cs1237_pulse_clock(state);
-    
-    /* 38th to 45th SCLK - input register data (8 bits) */
-    for (i = 0; i < 8; i++) {
-        /* Set data write pin before clock goes high (inverted) */
-        gpiod_set_value(state->din_gpio, !((config_byte >> (7 - i)) & 0x01));
-        cs1237_pulse_clock(state);
+    if (i) {
+        WRITE_ONCE(state->resyncs, state->resyncs + 1);
+        dev_warn_ratelimited(state->dev, "DOUT still low after read, sent %d extra clocks\n", i);
     }
     
-    /* Reset data write pin to low for reading */
-    gpiod_set_value(state->din_gpio, 0);
-    
+    *raw = raw_data;
     return 0;
 }
 
-static int cs1237_read_config(struct cs1237_state *state, u8 *config_byte)
+static int cs1237_gpio_config_xfer(struct cs1237_state *state, u8 cmd, u8 *config_byte,
+                                   u32 *raw)
 {
     int i;
     u8 result = 0;
+    u32 raw_data = 0;
     
-    /* Wait for data ready (DOUT goes low) */
-    if (!cs1237_wait_data_ready(state, 500)) {
-        dev_err(state->dev, "Timeout waiting for DOUT to go low during config read\n");
-        return -ETIMEDOUT;
+    /* Read 24 bits, the conversion that was ready */
+    for (i = 0; i < 24; i++) {
+        cs1237_sck_write(state, 1);
+        cs1237_sck_delay(state);
+        
+        raw_data = (raw_data << 1) | cs1237_dout_read(state);
+        
+        cs1237_sck_write(state, 0);
+        cs1237_sck_delay(state);
     }
     
-    /* Read 24 bits (discard) */
-    for (i = 0; i < 24; i++)
-        cs1237_pulse_clock(state);
-    
     /* 25th to 26th SCLKs - read register operation status */
     for (i = 0; i < 2; i++)
         cs1237_pulse_clock(state);
@@ -214,192 +828,1364 @@ static int cs1237_read_config(struct cs1237_state *state, u8 *config_byte)
         cs1237_pulse_clock(state);
     
     /* 30th to 36th SCLK - input register command word (7 bits) */
-    /* Send read command (0x56 = 0b01010110) */
     for (i = 0; i < 7; i++) {
-        /* Set data write pin before clock goes high (inverted) */
-        gpiod_set_value(state->din_gpio, !((CS1237_CMD_READ_REG >> (6 - i)) & 0x01));
-        cs1237_pulse_clock(state);
+        /* Set data write pin with the clock rising edge */
+        /* Note: The pin is inverted in hardware, so we invert the bit */
+        cs1237_pulse_clock_din(state, !((cmd >> (6 - i)) & 0x01));
     }
     
     /* 37th SCLK - switch direction (for read, DRDY/DOUT becomes output) */
+    cs1237_din_write(state, 0);
     cs1237_pulse_clock(state);
     
-    /* 38th to 45th SCLK - read register data (8 bits) */
+    /* 38th to 45th SCLK - write or read register data (8 bits) */
     for (i = 0; i < 8; i++) {
-        cs1237_pulse_clock(state);
-        /* Read bit from data_read_pin */
-        result = (result << 1) | gpiod_get_value(state->dout_gpio);
+        if (cmd == CS1237_CMD_WRITE_REG) {
+            /* Set data write pin with the clock rising edge (inverted) */
+            cs1237_pulse_clock_din(state, !((*config_byte >> (7 - i)) & 0x01));
+        } else {
+            cs1237_pulse_clock(state);
+            /* Read bit from data_read_pin */
+            result = (result << 1) | cs1237_dout_read(state);
+        }
     }
     
     /* Reset data write pin to low for reading */
-    gpiod_set_value(state->din_gpio, 0);
+    cs1237_din_write(state, 0);
     
-    *config_byte = result;
+    if (cmd == CS1237_CMD_READ_REG)
+        *config_byte = result;
+    if (raw)
+        *raw = raw_data;
     return 0;
 }
 
-static int cs1237_read_raw_value(struct cs1237_state *state, s32 *value)
+static void cs1237_gpio_set_sck(struct cs1237_state *state, int value)
 {
+    cs1237_sck_write(state, value);
+}
+
+/*
+ * Half period from the timing limits (or "chipsea,sck-half-period-ns"),
+ * minus what a GPIO write already costs on this board: on slow gpiolib
+ * paths the call itself covers the whole half period.
+ */
+static void cs1237_gpio_setup_timing(struct cs1237_state *state)
+{
+    u32 half_period_ns;
+    u64 start, call_ns;
     int i;
-    s32 raw_data = 0;
     
-    /* Check if data is ready (DOUT is low) */
-    if (gpiod_get_value(state->dout_gpio)){
-        dev_warn(state->dev, "DOUT is high during data read\n");
-        return -EBUSY;
-    }
-
-    /* Keep data_write_pin low for reading */
-    // GPIO.output(self.data_write_pin, GPIO.LOW)
-    gpiod_set_value(state->din_gpio, 0);
+    if (device_property_read_u32(state->dev, "chipsea,sck-half-period-ns", &half_period_ns))
+        half_period_ns = max(CS1237_T_SCK_MIN_NS,
+                             CS1237_T_DOUT_VALID_NS + CS1237_T_MARGIN_NS);
     
-    /* Read 24 bits */
-    for (i = 0; i < 24; i++) {
-        gpiod_set_value(state->sck_gpio, 1);
-        ndelay(500);
-        
-        raw_data = (raw_data << 1) | gpiod_get_value(state->dout_gpio);
-        
-        gpiod_set_value(state->sck_gpio, 0);
-        ndelay(500);
-    }
+    /* SCK is idle low, rewriting it does not clock the chip */
+    start = ktime_get_ns();
+    for (i = 0; i < 16; i++)
+        cs1237_sck_write(state, 0);
+    call_ns = div_u64(ktime_get_ns() - start, 16);
     
-    /* Additional clock cycles (25-27) to complete the reading */
-    for (i = 0; i < 3; i++)
-        cs1237_pulse_clock(state);
+    state->sck_delay_ns = half_period_ns > call_ns ? half_period_ns - call_ns : 0;
     
-    /* Make sure DOUT goes high again - send a few clock pulses if needed */
-    for (i = 0; i < 5; i++) {
-        if (gpiod_get_value(state->dout_gpio))
-            break;
-        cs1237_pulse_clock(state);
-    }
+    dev_info(state->dev, "SCK half period %u ns, GPIO write %llu ns%s\n",
+             half_period_ns, call_ns, state->sck_din ? ", batched SCK/DIN" : "");
+}
+
+static const struct cs1237_transport_ops cs1237_gpio_ops = {
+    .name = "gpio",
+    .read_sample = cs1237_gpio_read_sample,
+    .config_xfer = cs1237_gpio_config_xfer,
+    .set_sck = cs1237_gpio_set_sck,
+};
+
+#if IS_ENABLED(CONFIG_SPI)
+/*
+ * SPI transport: SCLK drives SCK, MISO samples DOUT and MOSI drives the
+ * (inverted) DIN line, so tx bits are the values the GPIO path would write
+ * to din_gpio. The chip needs exact clock counts, so each transaction is
+ * split into words whose size divides the count and that the controller
+ * supports. The DOUT GPIO is still used, input only, to sense DRDY.
+ */
+static const u8 cs1237_spi_read_bpw[] = { 27, 9, 3, 1 };
+static const u8 cs1237_spi_config_bpw[] = { 15, 9, 5, 3, 1 };
+
+static u8 cs1237_spi_pick_bpw(struct spi_device *spi, const u8 *candidates, int n)
+{
+    int i;
     
-    /* Convert to signed value */
-    if (raw_data & 0x800000)
-        raw_data = raw_data - 0x1000000;
+    for (i = 0; i < n; i++)
+        if (spi_is_bpw_supported(spi, candidates[i]))
+            return candidates[i];
     
-    *value = raw_data;
     return 0;
 }
 
-static int cs1237_conv_thread(void *data)
+/* Bytes of one SPI word in memory, as the SPI core lays out bits_per_word */
+static unsigned int cs1237_spi_word_size(u8 bpw)
 {
-    struct cs1237_state *state = data;
-    s32 value;
-    int sleep_time_us;
-    int ret;
+    return bpw > 16 ? 4 : bpw > 8 ? 2 : 1;
+}
+
+/* Split the low nbits of tx, MSB first, into nbits / bpw words of buf */
+static void cs1237_spi_pack(void *buf, unsigned int nbits, u8 bpw, u64 tx)
+{
+    unsigned int wsize = cs1237_spi_word_size(bpw);
+    u64 mask = BIT_ULL(bpw) - 1;
+    unsigned int i;
     
-    /* Calculate sleep time based on configured speed */
-    switch (state->speed) {
-    case CS1237_SPEED_10HZ:
-        sleep_time_us = 100000; /* ~95% of 100ms */
-        break;
-    case CS1237_SPEED_40HZ:
-        sleep_time_us = 25000; /* ~95% of 25ms */
-        break;
-    case CS1237_SPEED_640HZ:
-        sleep_time_us = 1563;  /* ~95% of 1562.5µs */
-        break;
-    case CS1237_SPEED_1280HZ:
-        sleep_time_us = 782;   /* ~95% of 781.25µs */
-        break;
-    default:
-        sleep_time_us = 1000;
-        break;
+    for (i = 0; i < nbits / bpw; i++) {
+        u32 word = (tx >> (nbits - (i + 1) * bpw)) & mask;
+        
+        if (wsize == 4)
+            ((u32 *)buf)[i] = word;
+        else if (wsize == 2)
+            ((u16 *)buf)[i] = word;
+        else
+            ((u8 *)buf)[i] = word;
     }
+}
+
+/* Inverse of cs1237_spi_pack(), ignoring bits above bpw in each word */
+static u64 cs1237_spi_unpack(const void *buf, unsigned int nbits, u8 bpw)
+{
+    unsigned int wsize = cs1237_spi_word_size(bpw);
+    u64 mask = BIT_ULL(bpw) - 1;
+    unsigned int i;
+    u64 result = 0;
     
-    while (!kthread_should_stop()) {
-        if (!state->running) {
-            msleep(10);
-            continue;
-        }
-        
-        ret = cs1237_read_raw_value(state, &value);
-        if (ret == 0) {
-            mutex_lock(&state->lock);
-            state->raw_data = value;
-            state->data_ready = true;
-            state->raw_counter++;
-            
-            /* Store data in circular buffer if available */
-            if (state->sample_buffer) {
-                state->sample_buffer[state->buffer_head] = value;
-                state->buffer_head = (state->buffer_head + 1) % state->buffer_size;
-            }
-            
-            /* Update statistics */
-            state->sum += value;
-            state->samples_count++;
-            mutex_unlock(&state->lock);
-        }
+    for (i = 0; i < nbits / bpw; i++) {
+        u32 word;
         
-        usleep_range(sleep_time_us, sleep_time_us + 100);
+        if (wsize == 4)
+            word = ((const u32 *)buf)[i];
+        else if (wsize == 2)
+            word = ((const u16 *)buf)[i];
+        else
+            word = ((const u8 *)buf)[i];
+        result = (result << bpw) | (word & mask);
     }
     
-    return 0;
+    return result;
 }
 
-static int cs1237_read_raw(struct iio_dev *indio_dev,
-                         struct iio_chan_spec const *chan,
-                         int *val, int *val2, long mask)
+/* Clock nbits (MSB first) out of tx and into rx as one spi_sync transfer */
+static int cs1237_spi_shift(struct cs1237_state *state, unsigned int nbits,
+                            u8 bpw, u64 tx, u64 *rx)
 {
-    struct cs1237_state *state = iio_priv(indio_dev);
+    struct spi_transfer xfer = {
+        .tx_buf = state->spi_tx,
+        .rx_buf = state->spi_rx,
+        .len = nbits / bpw * cs1237_spi_word_size(bpw),
+        .bits_per_word = bpw,
+    };
     int ret;
     
-    switch (mask) {
-    case IIO_CHAN_INFO_RAW:
-        /* Make sure the correct channel is selected */
-        if (state->channel != chan->channel) {
-            u8 config_byte = (state->speed & 0x03) |
-                           ((state->pga & 0x03) << 2) |
-                           ((chan->channel & 0x01) << 4) |
-                           ((state->refo & 0x01) << 5);
-            
-            mutex_lock(&state->lock);
-            ret = cs1237_write_config(state, config_byte);
-            if (ret) {
-                mutex_unlock(&state->lock);
-                return ret;
+    cs1237_spi_pack(state->spi_tx, nbits, bpw, tx);
+    
+    ret = spi_sync_transfer(state->spi, &xfer, 1);
+    if (ret)
+        return ret;
+    
+    *rx = cs1237_spi_unpack(state->spi_rx, nbits, bpw);
+    return 0;
+}
+
+static int cs1237_spi_read_sample(struct cs1237_state *state, u32 *raw)
+{
+    u64 rx;
+    int ret;
+    
+    /* DIN stays low, the 3 trailing clocks are don't care */
+    ret = cs1237_spi_shift(state, CS1237_READ_CLOCKS, state->spi_read_bpw, 0, &rx);
+    if (ret)
+        return ret;
+    
+    *raw = (rx >> 3) & 0xffffff;
+    return 0;
+}
+
+static int cs1237_spi_config_xfer(struct cs1237_state *state, u8 cmd, u8 *config_byte,
+                                  u32 *raw)
+{
+    u64 tx, rx;
+    int ret;
+    
+    /* Clocks 30-36: inverted command, clocks 38-45: inverted data on write */
+    tx = (u64)(~cmd & 0x7f) << 9;
+    if (cmd == CS1237_CMD_WRITE_REG)
+        tx |= (u8)~*config_byte;
+    
+    ret = cs1237_spi_shift(state, CS1237_CONFIG_CLOCKS, state->spi_config_bpw, tx, &rx);
+    if (ret)
+        return ret;
+    
+    if (cmd == CS1237_CMD_READ_REG)
+        *config_byte = rx & 0xff;
+    if (raw)
+        *raw = (rx >> 21) & 0xffffff;
+    return 0;
+}
+
+static const struct cs1237_transport_ops cs1237_spi_ops = {
+    .name = "spi",
+    .read_sample = cs1237_spi_read_sample,
+    .config_xfer = cs1237_spi_config_xfer,
+};
+#endif
+
+static u8 cs1237_pack_config(int speed, int pga, int channel, int refo)
+{
+    return (speed & 0x03) |
+           ((pga & 0x03) << 2) |
+           ((channel & 0x01) << 4) |
+           ((refo & 0x01) << 5);
+}
+
+static u8 cs1237_config_byte(struct cs1237_state *state, int channel)
+{
+    return cs1237_pack_config(state->speed, state->pga, channel, state->refo);
+}
+
+/* Power the chip up: SCK low after a high pulse. Only possible on GPIO */
+static void cs1237_power_up(struct cs1237_state *state)
+{
+    if (!state->ops->set_sck)
+        return;
+    
+    state->ops->set_sck(state, 1);
+    msleep(1);
+    state->ops->set_sck(state, 0);
+}
+
+static int cs1237_write_config(struct cs1237_state *state, u8 config_byte)
+{
+    /* Wait for data ready (DOUT goes low) */
+    if (!cs1237_wait_data_ready(state, 500)) {
+        dev_err(state->dev, "Timeout waiting for DOUT to go low during config write\n");
+        return -ETIMEDOUT;
+    }
+    
+    return state->ops->config_xfer(state, CS1237_CMD_WRITE_REG, &config_byte, NULL);
+}
+
+static int cs1237_read_config(struct cs1237_state *state, u8 *config_byte)
+{
+    /* Wait for data ready (DOUT goes low) */
+    if (!cs1237_wait_data_ready(state, 500)) {
+        dev_err(state->dev, "Timeout waiting for DOUT to go low during config read\n");
+        return -ETIMEDOUT;
+    }
+    
+    return state->ops->config_xfer(state, CS1237_CMD_READ_REG, config_byte, NULL);
+}
+
+static int cs1237_read_raw_value(struct cs1237_state *state, s32 *value)
+{
+    u32 raw_data;
+    int ret;
+    
+    /* Check if data is ready (DOUT is low) */
+    if (cs1237_dout_read(state)){
+        dev_warn_ratelimited(state->dev, "DOUT is high during data read\n");
+        return -EBUSY;
+    }
+    
+    ret = state->ops->read_sample(state, &raw_data);
+    if (ret)
+        return ret;
+    
+    /* Convert to signed value */
+    *value = sign_extend32(raw_data, 23);
+    return 0;
+}
+
+/* Power cycle and reconfigure the chip, acquisition paused and lock held */
+static int cs1237_reset_device(struct cs1237_state *state, u8 *config_byte)
+{
+    int ret;
+    
+    /* Power up sequence */
+    cs1237_power_up(state);
+    
+    /* Wait for data ready */
+    if (!cs1237_wait_data_ready(state, 500)) {
+        dev_err(state->dev, "CS1237 reset failed: device did not respond\n");
+        return -EIO;
+    }
+    
+    state->settle_count = cs1237_settle_samples[state->speed];
+    ret = cs1237_write_config(state, cs1237_config_byte(state, state->channel));
+    if (ret)
+        return ret;
+    
+    /* Verify configuration */
+    return cs1237_read_config(state, config_byte);
+}
+
+/* Index of the first element of sorted[0..n) that is not less than value */
+static int cs1237_sorted_lower_bound(const s32 *sorted, int n, s32 value)
+{
+    int lo = 0, hi = n;
+    
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        
+        if (sorted[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    return lo;
+}
+
+static void cs1237_filter_reset(struct cs1237_state *state)
+{
+    state->median_head = 0;
+    state->median_count = 0;
+    state->average_head = 0;
+    state->average_count = 0;
+    state->average_sum = 0;
+}
+
+/* Called with sample_lock held for writing */
+static void cs1237_filter_push(struct cs1237_state *state, s32 value)
+{
+    s32 *sorted = state->median_sorted;
+    int n = state->median_count;
+    s32 median;
+    int pos;
+    
+    /* Drop the oldest sample from the sorted window once it is full */
+    if (n == state->median_window) {
+        pos = cs1237_sorted_lower_bound(sorted, n, state->median_hist[state->median_head]);
+        memmove(&sorted[pos], &sorted[pos + 1], (n - pos - 1) * sizeof(*sorted));
+        n--;
+    }
+    
+    pos = cs1237_sorted_lower_bound(sorted, n, value);
+    memmove(&sorted[pos + 1], &sorted[pos], (n - pos) * sizeof(*sorted));
+    sorted[pos] = value;
+    n++;
+    
+    state->median_hist[state->median_head] = value;
+    state->median_head = (state->median_head + 1) % state->median_window;
+    state->median_count = n;
+    
+    /* The window is only even while it fills up */
+    median = sorted[n / 2];
+    if (!(n & 1))
+        median = (s32)div_s64((s64)sorted[n / 2 - 1] + median, 2);
+    
+    if (state->average_count == state->average_window)
+        state->average_sum -= state->average_hist[state->average_head];
+    else
+        state->average_count++;
+    
+    state->average_hist[state->average_head] = median;
+    state->average_sum += median;
+    state->average_head = (state->average_head + 1) % state->average_window;
+    
+    state->filtered = (s32)div_s64(state->average_sum, state->average_count);
+}
+
+static void cs1237_timing_reset(struct cs1237_timing *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+static unsigned int cs1237_timing_bucket(u64 ns)
+{
+    unsigned int msb;
+    unsigned int idx;
+    
+    if (ns < BIT(CS1237_HIST_SUB_BITS))
+        return ns;
+    
+    /* Top bit picks the power of two, the next ones the sub-bucket */
+    msb = fls64(ns) - 1;
+    idx = ((msb - CS1237_HIST_SUB_BITS + 1) << CS1237_HIST_SUB_BITS) |
+          ((ns >> (msb - CS1237_HIST_SUB_BITS)) & (BIT(CS1237_HIST_SUB_BITS) - 1));
+    
+    return min_t(unsigned int, idx, CS1237_HIST_BUCKETS - 1);
+}
+
+/* Largest duration that falls in a bucket */
+static u64 cs1237_timing_bucket_max(unsigned int idx)
+{
+    unsigned int shift;
+    u64 low;
+    
+    if (idx < BIT(CS1237_HIST_SUB_BITS))
+        return idx;
+    
+    shift = (idx >> CS1237_HIST_SUB_BITS) - 1;
+    low = (u64)(BIT(CS1237_HIST_SUB_BITS) | (idx & (BIT(CS1237_HIST_SUB_BITS) - 1))) << shift;
+    
+    return low + BIT_ULL(shift) - 1;
+}
+
+/* Called with sample_lock write-held, or lock for the benchmark */
+static void cs1237_timing_add(struct cs1237_timing *t, u64 ns)
+{
+    if (!t->count || ns < t->min)
+        t->min = ns;
+    if (ns > t->max)
+        t->max = ns;
+    t->sum += ns;
+    t->count++;
+    t->hist[cs1237_timing_bucket(ns)]++;
+}
+
+/* 99th percentile, to the histogram resolution */
+static u64 cs1237_timing_p99(struct cs1237_timing *t)
+{
+    u32 rank, seen = 0;
+    int i;
+    
+    rank = DIV_ROUND_UP((u64)t->count * 99, 100);
+    for (i = 0; rank && i < CS1237_HIST_BUCKETS; i++) {
+        seen += t->hist[i];
+        if (seen >= rank)
+            return min(cs1237_timing_bucket_max(i), t->max);
+    }
+    
+    return 0;
+}
+
+/* "min max mean p99" in nanoseconds, p99 to the histogram resolution */
+static ssize_t cs1237_timing_show(struct cs1237_state *state, struct cs1237_timing *t,
+                                  char *buf)
+{
+    unsigned int seq;
+    u64 min, max, mean, p99;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        min = t->min;
+        max = t->max;
+        mean = t->count ? div_u64(t->sum, t->count) : 0;
+        p99 = cs1237_timing_p99(t);
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return sysfs_emit(buf, "%llu %llu %llu %llu\n", min, max, mean, p99);
+}
+
+static void cs1237_deque_push(struct cs1237_deque *dq, u32 size, u32 pos, s32 value,
+                              bool is_max)
+{
+    struct cs1237_deque_entry *back;
+    
+    /* Drop the front once it has left the window */
+    if (dq->len && pos - dq->entries[dq->head].pos >= size) {
+        dq->head = (dq->head + 1) % size;
+        dq->len--;
+    }
+    
+    /* Entries no better than the new value can never be the extreme again */
+    while (dq->len) {
+        back = &dq->entries[(dq->head + dq->len - 1) % size];
+        if (is_max ? back->value > value : back->value < value)
+            break;
+        dq->len--;
+    }
+    
+    back = &dq->entries[(dq->head + dq->len) % size];
+    back->value = value;
+    back->pos = pos;
+    dq->len++;
+}
+
+/* Store a channel A sample in the ring, called with sample_lock write-held */
+static void cs1237_history_push(struct cs1237_state *state, s32 value)
+{
+    s32 old;
+    
+    if (state->buffer_count == state->buffer_size) {
+        old = state->sample_buffer[state->buffer_head];
+        state->win_sum -= old;
+        state->win_sumsq -= (u64)((s64)old * old);
+    } else {
+        state->buffer_count++;
+    }
+    state->win_sum += value;
+    state->win_sumsq += (u64)((s64)value * value);
+    
+    state->sample_buffer[state->buffer_head] = value;
+    state->buffer_head = (state->buffer_head + 1) % state->buffer_size;
+    
+    cs1237_deque_push(&state->win_min, state->buffer_size, state->buffer_total, value, false);
+    cs1237_deque_push(&state->win_max, state->buffer_size, state->buffer_total, value, true);
+    state->buffer_total++;
+    
+    state->total_count++;
+    state->total_sum += value;
+}
+
+static irqreturn_t cs1237_drdy_irq(int irq, void *data)
+{
+    struct iio_dev *indio_dev = data;
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    state->drdy_ns = ktime_get_ns();
+    state->drdy_timestamp = iio_get_time_ns(indio_dev);
+    
+    /* Masked until cs1237_acq_work() has clocked the sample out */
+    disable_irq_nosync(irq);
+    kthread_queue_work(cs1237_worker, &state->acq_work);
+    
+    return IRQ_HANDLED;
+}
+
+/*
+ * Polling fallback for DOUT lines that can not interrupt. The timer fires
+ * once per conversion period and masks itself like the IRQ does until
+ * cs1237_acq_work() re-arms it. A ready sample pulls the next poll 1/16
+ * period earlier and an early poll retries 1/16 period later, so polls
+ * lock on just after DRDY instead of drifting against the chip clock.
+ */
+static enum hrtimer_restart cs1237_poll_timer(struct hrtimer *timer)
+{
+    struct cs1237_state *state = container_of(timer, struct cs1237_state, poll_timer);
+    unsigned long flags;
+    
+    state->drdy_ns = ktime_get_ns();
+    state->drdy_timestamp = iio_get_time_ns(state->indio_dev);
+    
+    spin_lock_irqsave(&state->poll_lock, flags);
+    state->poll_depth++;
+    spin_unlock_irqrestore(&state->poll_lock, flags);
+    kthread_queue_work(cs1237_worker, &state->acq_work);
+    
+    return HRTIMER_NORESTART;
+}
+
+/* enable_irq() / disable_irq() for either DRDY source, nesting the same way */
+static void cs1237_drdy_enable(struct cs1237_state *state)
+{
+    unsigned long flags;
+    
+    if (!state->poll) {
+        enable_irq(state->irq);
+        return;
+    }
+    
+    spin_lock_irqsave(&state->poll_lock, flags);
+    if (!--state->poll_depth)
+        hrtimer_start(&state->poll_timer, state->poll_expires, HRTIMER_MODE_ABS_HARD);
+    spin_unlock_irqrestore(&state->poll_lock, flags);
+}
+
+static void cs1237_drdy_disable(struct cs1237_state *state, bool sync)
+{
+    unsigned long flags;
+    
+    if (!state->poll) {
+        if (sync)
+            disable_irq(state->irq);
+        else
+            disable_irq_nosync(state->irq);
+        return;
+    }
+    
+    spin_lock_irqsave(&state->poll_lock, flags);
+    state->poll_depth++;
+    hrtimer_try_to_cancel(&state->poll_timer);
+    spin_unlock_irqrestore(&state->poll_lock, flags);
+    
+    /* A callback already running has queued its work, like a hard IRQ */
+    if (sync)
+        hrtimer_cancel(&state->poll_timer);
+}
+
+/*
+ * Stopping acquisition only masks DRDY without waiting. A hard handler or
+ * poll callback still running on another CPU may queue the work once more,
+ * so wait for it before cancelling or flushing that work.
+ */
+static void cs1237_drdy_sync(struct cs1237_state *state)
+{
+    if (state->poll)
+        hrtimer_cancel(&state->poll_timer);
+    else
+        synchronize_irq(state->irq);
+}
+
+/* Largest channel A value, 24 bits or 31 once normalised by autorange */
+static int cs1237_value_max(struct cs1237_state *state)
+{
+    return state->autorange ? (1 << 30) - 1 : (1 << 23) - 1;
+}
+
+/* Corrected channel A sample, kept within the bits the scan type promises */
+static s32 cs1237_calibrate(struct cs1237_state *state, s32 value)
+{
+    int bias = READ_ONCE(state->calibbias);
+    int scale = READ_ONCE(state->calibscale);
+    s64 corrected;
+    
+    if (!bias && scale == MICRO)
+        return value;
+    
+    corrected = div_s64(((s64)value + bias) * scale, MICRO);
+    return clamp_t(s64, corrected, -cs1237_value_max(state) - 1, cs1237_value_max(state));
+}
+
+/* A sample converted at gain pga, on the PGA=128 scale autorange reports */
+static s32 cs1237_range_normalise(int pga, s32 value)
+{
+    return value * (1 << cs1237_pga_shift[pga]);
+}
+
+/*
+ * Pick the gain for the coming conversions from a settled channel A sample
+ * taken at gain pga. Near full scale steps down at once, before the input
+ * clips; stepping up waits for CS1237_RANGE_HOLD samples in a row that
+ * would all stay below half scale at the new gain. The gap between 1/2
+ * and 7/8 of full scale keeps the two from chasing each other.
+ */
+static void cs1237_autorange(struct cs1237_state *state, int pga, s32 value)
+{
+    u32 mag = abs(value);
+    int target;
+    
+    if (mag >= 7 << 20) {
+        state->range_pga = max(pga - 1, CS1237_PGA_1);
+        state->range_hold = 0;
+        return;
+    }
+    
+    state->range_peak = state->range_hold ? max(state->range_peak, mag) : mag;
+    if (pga == CS1237_PGA_128 ||
+        state->range_peak << (cs1237_pga_shift[pga] - cs1237_pga_shift[pga + 1]) >= 1 << 22) {
+        state->range_hold = 0;
+        return;
+    }
+    
+    if (++state->range_hold < CS1237_RANGE_HOLD)
+        return;
+    
+    /* Highest gain that keeps the peak below half scale */
+    for (target = CS1237_PGA_128; target > pga; target--)
+        if (state->range_peak << (cs1237_pga_shift[pga] - cs1237_pga_shift[target]) < 1 << 22)
+            break;
+    state->range_pga = target;
+    state->range_hold = 0;
+}
+
+/* Append to the mapped capture ring, if open. Runs on the acquisition work */
+static void cs1237_capture_push(struct cs1237_state *state, s32 value, u32 meta)
+{
+    struct cs1237_capture_header *hdr = READ_ONCE(state->capture_ring);
+    struct cs1237_capture_record *rec;
+    u32 head = state->capture_head;
+    
+    if (!hdr)
+        return;
+    
+    rec = (void *)hdr + PAGE_SIZE;
+    rec += head & (state->capture_records - 1);
+    rec->value = value;
+    rec->channel = FIELD_GET(CS1237_META_INPUT, meta);
+    rec->pga = FIELD_GET(CS1237_META_PGA, meta);
+    rec->speed = FIELD_GET(CS1237_META_SPEED, meta);
+    rec->flags = FIELD_GET(CS1237_META_FLAGS, meta);
+    rec->timestamp = state->drdy_timestamp;
+    
+    /* Record contents before the head that publishes them */
+    state->capture_head = ++head;
+    smp_store_release(&hdr->head, head);
+    
+    if (head - READ_ONCE(hdr->tail) >= max(READ_ONCE(hdr->watermark), 1U))
+        wake_up_interruptible(&state->capture_wq);
+}
+
+static void cs1237_check_events(struct cs1237_state *state)
+{
+    s32 filtered = state->filtered;
+    bool rising, crossed;
+    int thresh, hyst;
+    int i;
+    
+    if (!state->average_count)
+        return;
+    
+    for (i = 0; i < 2; i++) {
+        if (!READ_ONCE(state->ev_enabled[i]))
+            continue;
+        
+        rising = i == 0;
+        thresh = READ_ONCE(state->ev_thresh[i]);
+        hyst = READ_ONCE(state->ev_hyst[i]);
+        
+        if (!READ_ONCE(state->ev_armed[i])) {
+            /* Back on the quiet side of the hysteresis band */
+            if (rising ? filtered < (s64)thresh - hyst : filtered > (s64)thresh + hyst)
+                WRITE_ONCE(state->ev_armed[i], true);
+            continue;
+        }
+        
+        crossed = rising ? filtered > thresh : filtered < thresh;
+        if (!crossed)
+            continue;
+        
+        iio_push_event(state->indio_dev,
+                       IIO_UNMOD_EVENT_CODE(IIO_VOLTAGE, 0, IIO_EV_TYPE_THRESH,
+                                            rising ? IIO_EV_DIR_RISING : IIO_EV_DIR_FALLING),
+                       state->drdy_timestamp);
+        WRITE_ONCE(state->ev_armed[i], false);
+    }
+}
+
+/* Input for the next conversion, decided before this one is clocked out */
+static int cs1237_mux_next(struct cs1237_state *state)
+{
+    int interval = READ_ONCE(state->temp_interval);
+    
+    if (!interval)
+        return state->channel;
+    if (state->channel == CS1237_CHANNEL_TEMP)
+        return CS1237_CHANNEL_A;
+    if (state->mux_count + 1 >= interval)
+        return CS1237_CHANNEL_TEMP;
+    return CS1237_CHANNEL_A;
+}
+
+/*
+ * Data-ready work. DOUT doubles as DRDY and falls when a conversion
+ * completes. The IRQ stays masked until the 27 clocks of the read have been
+ * sent, so the data bits shifted out on DOUT can not retrigger us. Edges
+ * latched while masked are replayed on unmask; by then DOUT is back high,
+ * which is how they are told apart from a real DRDY.
+ */
+static void cs1237_acq_read(struct cs1237_state *state)
+{
+    struct iio_dev *indio_dev = state->indio_dev;
+    int channel = state->channel;
+    bool settling = state->settle_count > 0;
+    int pending = atomic_xchg(&state->pending_config, -1);
+    bool rate_changed = false;
+    bool switched = false;
+    int next = channel;
+    int speed, pga;
+    /* Gain and rate the sample being read was converted at */
+    int sample_pga = state->pga;
+    int sample_speed = state->speed;
+    unsigned int resyncs = state->resyncs;
+    u64 start_ns, end_ns;
+    u64 period_ns = NSEC_PER_SEC / cs1237_sample_rates[state->speed];
+    u8 config_byte;
+    u32 raw, meta;
+    s32 value;
+    int ret;
+    
+    /*
+     * Replayed edge, DOUT is back high. A conversion really lost this way
+     * shows up as a gap in the DRDY interval below, so it is not counted here
+     */
+    if (cs1237_dout_read(state))
+        return;
+    
+    start_ns = ktime_get_ns();
+    
+    if (!settling)
+        next = cs1237_mux_next(state);
+    
+    speed = pending >= 0 ? pending & 0x03 : state->speed;
+    pga = pending >= 0 ? (pending >> 2) & 0x03 : state->pga;
+    if (state->autorange)
+        pga = state->range_pga;
+    
+    if (next != channel || pending >= 0 || pga != state->pga) {
+        /*
+         * Switch inputs, rate or gain in the same transaction that reads
+         * this sample; the conversion loop itself never stops
+         */
+        config_byte = cs1237_pack_config(speed, pga, next, state->refo);
+        ret = state->ops->config_xfer(state, CS1237_CMD_WRITE_REG, &config_byte, &raw);
+        if (ret) {
+            /* Retry with the next conversion unless a newer one is queued */
+            if (pending >= 0)
+                atomic_cmpxchg(&state->pending_config, -1, pending);
+            return;
+        }
+        value = sign_extend32(raw, 23);
+        rate_changed = speed != state->speed;
+        state->channel = next;
+        state->speed = speed;
+        state->pga = pga;
+        state->settle_count = cs1237_settle_samples[speed];
+        switched = true;
+        if (pending >= 0)
+            WRITE_ONCE(state->config_seq, state->config_seq + 1);
+    } else {
+        ret = cs1237_read_raw_value(state, &value);
+        if (ret)
+            return;
+    }
+    
+    end_ns = ktime_get_ns();
+    WRITE_ONCE(state->xfers, state->xfers + 1);
+    if (state->resyncs != resyncs)
+        state->sample_flags |= CS1237_FLAG_RESYNC;
+    
+    if (start_ns - state->drdy_ns > period_ns)
+        WRITE_ONCE(state->overruns, state->overruns + 1);
+    if (state->last_drdy_ns && state->drdy_ns - state->last_drdy_ns > period_ns * 3 / 2)
+        WRITE_ONCE(state->missed, state->missed +
+                   div64_u64(state->drdy_ns - state->last_drdy_ns + period_ns / 2,
+                             period_ns) - 1);
+    
+    if (channel == CS1237_CHANNEL_A && !settling)
+        state->mux_count = next == CS1237_CHANNEL_TEMP ? 0 : state->mux_count + 1;
+    
+    write_seqlock(&state->sample_lock);
+    cs1237_timing_add(&state->latency, start_ns - state->drdy_ns);
+    cs1237_timing_add(&state->xfer_time, end_ns - start_ns);
+    if (state->last_drdy_ns)
+        cs1237_timing_add(&state->interval, state->drdy_ns - state->last_drdy_ns);
+    /* Edges at two different rates are not a conversion interval */
+    state->last_drdy_ns = rate_changed ? 0 : state->drdy_ns;
+    
+    /*
+     * Conversions started before the switch settled are not kept. One read
+     * by a new switch predates it, and does not count towards settling it
+     */
+    if (settling) {
+        if (!switched)
+            state->settle_count--;
+        state->sample_flags |= CS1237_FLAG_SETTLED;
+        state->dec_count = 0;
+        state->dec_sum = 0;
+        write_sequnlock(&state->sample_lock);
+        if (pending >= 0)
+            wake_up_all(&state->sample_wq);
+        return;
+    }
+    
+    /* Gain steps are decided on the chip's own counts, then normalised */
+    if (channel == CS1237_CHANNEL_A && state->autorange) {
+        if (sample_pga == state->pga && state->range_pga == state->pga)
+            cs1237_autorange(state, sample_pga, value);
+        value = cs1237_range_normalise(sample_pga, value);
+    }
+    
+    /* Boxcar decimation, only every osr-th conversion yields a sample */
+    if (channel == CS1237_CHANNEL_A) {
+        int osr = READ_ONCE(state->osr);
+        
+        if (osr != state->dec_osr) {
+            state->dec_osr = osr;
+            state->dec_count = 0;
+            state->dec_sum = 0;
+        }
+        if (osr > 1) {
+            state->dec_sum += value;
+            if (++state->dec_count < osr) {
+                write_sequnlock(&state->sample_lock);
+                return;
             }
-            state->channel = chan->channel;
-            mutex_unlock(&state->lock);
-            
-            /* Wait for a new reading to be available */
-            msleep(100);
+            value = (s32)((state->dec_sum + (osr >> 1)) >> ilog2(osr));
+            state->dec_count = 0;
+            state->dec_sum = 0;
         }
+    }
+    
+    if (channel == CS1237_CHANNEL_A)
+        value = cs1237_calibrate(state, value);
+    
+    meta = FIELD_PREP(CS1237_META_SEQ, state->xfers + state->missed) |
+           FIELD_PREP(CS1237_META_PGA, sample_pga) |
+           FIELD_PREP(CS1237_META_SPEED, sample_speed) |
+           FIELD_PREP(CS1237_META_INPUT, channel) |
+           FIELD_PREP(CS1237_META_FLAGS, state->sample_flags);
+    state->sample_flags = 0;
+    
+    state->chan_data[channel] = value;
+    state->chan_time_ns[channel] = state->drdy_ns;
+    state->chan_count[channel]++;
+    state->raw_counter++;
+    
+    /* History, statistics and filter follow channel A */
+    if (channel == CS1237_CHANNEL_A) {
+        /* Store data in circular buffer if available */
+        if (state->sample_buffer)
+            cs1237_history_push(state, value);
         
-        mutex_lock(&state->lock);
-        if (!state->data_ready) {
-            mutex_unlock(&state->lock);
-            return -EBUSY;
+        /* Update statistics */
+        state->sum += value;
+        state->samples_count++;
+        
+        if (state->burst_count < state->burst_target) {
+            state->burst_sum += value;
+            state->burst_count++;
         }
-        *val = state->raw_data;
+        
+        cs1237_filter_push(state, value);
+    }
+    write_sequnlock(&state->sample_lock);
+    
+    wake_up_all(&state->sample_wq);
+    
+    if (channel == CS1237_CHANNEL_A)
+        cs1237_check_events(state);
+    
+    cs1237_capture_push(state, value, meta);
+    
+    /* Hand the sample to the buffer, cs1237_trigger_handler() runs nested */
+    if (iio_buffer_enabled(indio_dev) && channel == state->buffer_channel) {
+        state->scan.data = value;
+        state->scan.meta = meta;
+        iio_trigger_poll_nested(state->trig);
+    }
+}
+
+static void cs1237_acq_work(struct kthread_work *work)
+{
+    struct cs1237_state *state = container_of(work, struct cs1237_state, acq_work);
+    
+    u64 period_ns;
+    ktime_t expires;
+    unsigned long flags;
+    
+    if (!state->poll) {
+        cs1237_acq_read(state);
+        enable_irq(state->irq);
+        return;
+    }
+    
+    if (cs1237_dout_read(state)) {
+        /* Early, the conversion is still running */
+        period_ns = NSEC_PER_SEC / cs1237_sample_rates[state->speed];
+        expires = ktime_add_ns(ktime_get(), period_ns / 16);
+    } else {
+        cs1237_acq_read(state);
+        /* After the read, which may have changed the rate */
+        period_ns = NSEC_PER_SEC / cs1237_sample_rates[state->speed];
+        expires = ktime_add_ns(state->poll_expires, period_ns - period_ns / 16);
+    }
+    
+    spin_lock_irqsave(&state->poll_lock, flags);
+    state->poll_expires = expires;
+    spin_unlock_irqrestore(&state->poll_lock, flags);
+    cs1237_drdy_enable(state);
+}
+
+/*
+ * Keep the acquisition work off the bus while a config transaction drives
+ * SCK. Disabling DRDY nests and waits for a running hard handler or poll
+ * timer, the flush then waits for the read it may have queued. Callers hold
+ * state->lock, so a pause cannot stall a config queued by a waiter on it.
+ */
+static void cs1237_acq_pause(struct cs1237_state *state)
+{
+    cs1237_drdy_disable(state, true);
+    kthread_flush_work(&state->acq_work);
+    
+    /* The gap is not a conversion interval */
+    state->last_drdy_ns = 0;
+}
+
+static void cs1237_acq_resume(struct cs1237_state *state)
+{
+    cs1237_drdy_enable(state);
+}
+
+static unsigned long cs1237_watchdog_timeout(struct cs1237_state *state)
+{
+    unsigned int ms = CS1237_STUCK_PERIODS * MSEC_PER_SEC / cs1237_sample_rates[state->speed];
+    
+    return msecs_to_jiffies(max_t(unsigned int, ms, CS1237_STUCK_MIN_MS));
+}
+
+/*
+ * DOUT stuck at either level means no DRDY edge and no reads. Runs on
+ * system_wq, not the shared acquisition worker: a reset waits up to
+ * seconds for the chip, and the other chips must keep being read meanwhile.
+ */
+static void cs1237_watchdog_work(struct work_struct *work)
+{
+    struct cs1237_state *state = container_of(to_delayed_work(work),
+                                              struct cs1237_state, watchdog);
+    u8 config_byte;
+    int ret;
+    
+    /* Someone is reconfiguring the chip, check again next round */
+    if (!mutex_trylock(&state->lock))
+        goto rearm;
+    
+    if (!state->running) {
         mutex_unlock(&state->lock);
+        return;
+    }
+    
+    if (state->xfers == state->watchdog_xfers) {
+        dev_warn_ratelimited(state->dev, "no conversion for %d periods (DOUT %s), resetting\n",
+                             CS1237_STUCK_PERIODS,
+                             cs1237_dout_read(state) ? "high" : "low");
+        
+        cs1237_acq_pause(state);
+        ret = cs1237_reset_device(state, &config_byte);
+        cs1237_acq_resume(state);
+        WRITE_ONCE(state->stuck_resets, state->stuck_resets + 1);
+        if (ret)
+            dev_err_ratelimited(state->dev, "watchdog reset failed: %d\n", ret);
+    }
+    state->watchdog_xfers = state->xfers;
+    mutex_unlock(&state->lock);
+    
+rearm:
+    queue_delayed_work(system_wq, &state->watchdog, cs1237_watchdog_timeout(state));
+}
+
+static irqreturn_t cs1237_trigger_handler(int irq, void *p)
+{
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    iio_push_to_buffers_with_timestamp(indio_dev, &state->scan,
+                                       state->drdy_timestamp);
+    iio_trigger_notify_done(indio_dev->trig);
+    
+    return IRQ_HANDLED;
+}
+
+/* Sample while enabled by the user and not runtime suspended, lock held */
+static void cs1237_update_running(struct cs1237_state *state)
+{
+    bool running = state->enabled && !state->suspended;
+    
+    if (running != state->running) {
+        state->running = running;
+        if (running) {
+            state->last_drdy_ns = 0;
+            cs1237_drdy_enable(state);
+            mod_delayed_work(system_wq, &state->watchdog, cs1237_watchdog_timeout(state));
+        } else {
+            cs1237_drdy_disable(state, false);
+        }
+    }
+}
+
+static void cs1237_set_enabled(struct cs1237_state *state, bool enabled)
+{
+    mutex_lock(&state->lock);
+    state->enabled = enabled;
+    cs1237_update_running(state);
+    mutex_unlock(&state->lock);
+}
+
+static int cs1237_select_channel(struct cs1237_state *state, int channel)
+{
+    int ret;
+    
+    if (state->channel == channel)
+        return 0;
+    
+    mutex_lock(&state->lock);
+    cs1237_acq_pause(state);
+    ret = cs1237_write_config(state, cs1237_config_byte(state, channel));
+    if (!ret) {
+        state->channel = channel;
+        state->settle_count = cs1237_settle_samples[state->speed];
+    }
+    cs1237_acq_resume(state);
+    mutex_unlock(&state->lock);
+    
+    return ret;
+}
+
+static int cs1237_sample_counter(struct cs1237_state *state)
+{
+    unsigned int seq;
+    int counter;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        counter = state->raw_counter;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return counter;
+}
+
+static unsigned int cs1237_chan_counter(struct cs1237_state *state, int channel)
+{
+    unsigned int seq;
+    unsigned int counter;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        counter = state->chan_count[channel];
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return counter;
+}
+
+/*
+ * Longest wait for a fresh sample of one input: a full multiplexing round
+ * and the settling conversions, plus two periods and scheduling slack.
+ */
+static unsigned long cs1237_sample_timeout(struct cs1237_state *state)
+{
+    int conversions = 2 + cs1237_settle_samples[state->speed] + READ_ONCE(state->temp_interval) +
+                      READ_ONCE(state->osr);
+    
+    return msecs_to_jiffies(conversions * MSEC_PER_SEC / cs1237_sample_rates[state->speed] + 20);
+}
+
+/* Latest settled conversion of an input, switching to it if needed */
+static int cs1237_read_channel(struct iio_dev *indio_dev, int channel, int *val)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    unsigned int seq;
+    unsigned int counter;
+    bool wait;
+    int ret;
+    
+    counter = cs1237_chan_counter(state, channel);
+    wait = !counter;
+    
+    /* Without multiplexing, switch to the input on demand */
+    if (!READ_ONCE(state->temp_interval) && state->channel != channel) {
+        /* The buffer owns the input selection while enabled */
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+        ret = cs1237_select_channel(state, channel);
+        iio_device_release_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+        wait = true;
+    }
+    
+    /* Wait for the first settled conversion on the input */
+    if (wait && !wait_event_timeout(state->sample_wq,
+                                    cs1237_chan_counter(state, channel) != counter,
+                                    cs1237_sample_timeout(state)))
+        return -ETIMEDOUT;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        *val = state->chan_data[channel];
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return IIO_VAL_INT;
+}
+
+/* Samples collected so far by the burst in progress, and their sum */
+static unsigned int cs1237_burst_progress(struct cs1237_state *state, s64 *sum)
+{
+    unsigned int seq;
+    unsigned int count;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        count = state->burst_count;
+        *sum = state->burst_sum;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return count;
+}
+
+/*
+ * Single-shot read: wake the chip, average the next `burst` settled channel
+ * A samples, then power it down straight away rather than after the
+ * autosuspend delay. Concurrent bursts queue up, each gets its own samples.
+ */
+static int cs1237_read_burst(struct iio_dev *indio_dev, int burst, int *val)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    unsigned int count = 0;
+    s64 sum = 0;
+    int ret;
+    
+    mutex_lock(&state->burst_lock);
+    ret = cs1237_pm_get(state);
+    if (ret)
+        goto out_unlock;
+    
+    /* Without multiplexing, switch to channel A on demand */
+    if (!READ_ONCE(state->temp_interval) && state->channel != CS1237_CHANNEL_A) {
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret)
+            goto out_put;
+        ret = cs1237_select_channel(state, CS1237_CHANNEL_A);
+        iio_device_release_direct_mode(indio_dev);
+        if (ret)
+            goto out_put;
+    }
+    
+    write_seqlock(&state->sample_lock);
+    state->burst_sum = 0;
+    state->burst_count = 0;
+    state->burst_target = burst;
+    write_sequnlock(&state->sample_lock);
+    
+    /* Each sample must follow the previous one within the usual timeout */
+    while (count < burst) {
+        if (!wait_event_timeout(state->sample_wq,
+                                cs1237_burst_progress(state, &sum) != count,
+                                cs1237_sample_timeout(state))) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        count = cs1237_burst_progress(state, &sum);
+    }
+    
+    write_seqlock(&state->sample_lock);
+    state->burst_target = 0;
+    write_sequnlock(&state->sample_lock);
+    
+    if (!ret)
+        *val = (s32)div_s64(sum, burst);
+    
+out_put:
+    /* Suspends only if no buffer or other reader still holds the chip */
+    pm_runtime_put_sync_suspend(state->dev);
+out_unlock:
+    mutex_unlock(&state->burst_lock);
+    return ret;
+}
+
+/*
+ * Latest conversion of an input, for in-kernel consumers: never switches
+ * the input or touches the bus. Only the first conversion after resume is
+ * waited for; an input that is not being converted answers from its last
+ * sample, or -EBUSY if it never had one.
+ */
+static int cs1237_read_cached(struct cs1237_state *state, int channel, s32 *val)
+{
+    unsigned int seq;
+    bool converted;
+    int ret;
+    
+    ret = cs1237_pm_get(state);
+    if (ret)
+        return ret;
+    
+    converted = READ_ONCE(state->temp_interval) || READ_ONCE(state->channel) == channel;
+    if (!cs1237_chan_counter(state, channel) &&
+        (!converted || !wait_event_timeout(state->sample_wq,
+                                           cs1237_chan_counter(state, channel),
+                                           cs1237_sample_timeout(state)))) {
+        cs1237_pm_put(state);
+        return converted ? -ETIMEDOUT : -EBUSY;
+    }
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        *val = state->chan_data[channel];
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    cs1237_pm_put(state);
+    return 0;
+}
+
+/* Denominator of the mV per count scale, 3300 / (2^23 * gain) */
+static int cs1237_scale_div(struct cs1237_state *state, struct iio_chan_spec const *chan)
+{
+    /* Autorange normalises every gain to the PGA=128 scale */
+    if (state->autorange && chan->type == IIO_VOLTAGE)
+        return 8388608 * 128;
+    
+    return 8388608 * cs1237_pga_gains[READ_ONCE(state->pga)];
+}
+
+/*
+ * Temperature in milli-degC from a cached raw reading. The sensor output is
+ * proportional to absolute temperature, so one calibration point gives the
+ * slope; both readings are compared on the PGA=128 scale.
+ */
+static int cs1237_temp_processed(struct cs1237_state *state, int *val)
+{
+    unsigned int seq;
+    s32 cal_raw, raw;
+    int cal_pga, cal_mdegc, ret;
+    s64 ref;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        cal_raw = state->temp_cal_raw;
+        cal_pga = state->temp_cal_pga;
+        cal_mdegc = state->temp_cal_mdegc;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    if (!cal_raw)
+        return -ENODATA;
+    
+    ret = cs1237_read_cached(state, CS1237_CHANNEL_TEMP, &raw);
+    if (ret)
+        return ret;
+    
+    ref = cs1237_range_normalise(cal_pga, cal_raw);
+    *val = div64_s64((s64)cs1237_range_normalise(READ_ONCE(state->pga), raw) *
+                     (cal_mdegc + 273150), ref) - 273150;
+    return IIO_VAL_INT;
+}
+
+static int cs1237_read_raw(struct iio_dev *indio_dev,
+                         struct iio_chan_spec const *chan,
+                         int *val, int *val2, long mask)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    s64 micro;
+    s32 raw;
+    int burst;
+    int ret;
+    
+    switch (mask) {
+    case IIO_CHAN_INFO_RAW:
+        burst = READ_ONCE(state->burst);
+        if (burst && chan->type == IIO_VOLTAGE) {
+            ret = cs1237_read_burst(indio_dev, burst, val);
+            return ret ? ret : IIO_VAL_INT;
+        }
+        
+        ret = cs1237_pm_get(state);
+        if (ret)
+            return ret;
+        ret = cs1237_read_channel(indio_dev, chan->channel, val);
+        cs1237_pm_put(state);
+        return ret;
+        
+    case IIO_CHAN_INFO_PROCESSED:
+        /* From the cache, consumers never switch the input or touch the bus */
+        if (chan->type == IIO_TEMP)
+            return cs1237_temp_processed(state, val);
+        
+        /* (raw + offset) * scale in mV */
+        ret = cs1237_read_cached(state, chan->channel, &raw);
+        if (ret)
+            return ret;
+        micro = (s64)raw + READ_ONCE(state->offset);
+        micro = div_s64(micro * 3300 * MICRO, cs1237_scale_div(state, chan));
+        *val = div_s64_rem(micro, MICRO, val2);
+        return IIO_VAL_INT_PLUS_MICRO;
+        
+    case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+        *val = READ_ONCE(state->osr);
+        return IIO_VAL_INT;
+        
+    case IIO_CHAN_INFO_CALIBBIAS:
+        *val = READ_ONCE(state->calibbias);
+        return IIO_VAL_INT;
+        
+    case IIO_CHAN_INFO_CALIBSCALE:
+        *val = READ_ONCE(state->calibscale) / MICRO;
+        *val2 = READ_ONCE(state->calibscale) % MICRO;
+        return IIO_VAL_INT_PLUS_MICRO;
+        
+    case IIO_CHAN_INFO_OFFSET:
+        *val = READ_ONCE(state->offset);
         return IIO_VAL_INT;
         
     case IIO_CHAN_INFO_SCALE:
         /* Scale factor calculation (3.3V reference with various PGA settings) */
         /* For 24-bit ADC, full scale is 2^23 (8388608) */
         *val = 3300; /* voltage in mV */
-        
-        switch (state->pga) {
-        case CS1237_PGA_1:
-            *val2 = 8388608; /* Divide by 2^23 */
-            break;
-        case CS1237_PGA_2:
-            *val2 = 8388608 * 2; /* Additional factor of 2 */
-            break;
-        case CS1237_PGA_64:
-            *val2 = 8388608 * 64; /* Additional factor of 64 */
-            break;
-        case CS1237_PGA_128:
-            *val2 = 8388608 * 128; /* Additional factor of 128 */
-            break;
-        default:
-            *val2 = 8388608;
-            break;
-        }
+        *val2 = cs1237_scale_div(state, chan);
         return IIO_VAL_FRACTIONAL;
         
     case IIO_CHAN_INFO_SAMP_FREQ:
@@ -411,15 +2197,22 @@ static int cs1237_read_raw(struct iio_dev *indio_dev,
     }
 }
 
+static int cs1237_apply_config(struct cs1237_state *state, int speed_setting, int pga_setting);
+
+/* Largest power of two not above the ODR */
+static int cs1237_osr_max(int speed)
+{
+    return min(1 << ilog2(cs1237_sample_rates[speed]), CS1237_OSR_MAX);
+}
+
 static int cs1237_write_raw(struct iio_dev *indio_dev,
                           struct iio_chan_spec const *chan,
                           int val, int val2, long mask)
 {
     struct cs1237_state *state = iio_priv(indio_dev);
-    int ret;
-    u8 speed_setting = state->speed;
-    u8 pga_setting = state->pga;
-    u8 config_byte;
+    int ret = 0;
+    int speed_setting = -1;
+    int pga_setting = -1;
     
     switch (mask) {
     case IIO_CHAN_INFO_SAMP_FREQ:
@@ -439,6 +2232,8 @@ static int cs1237_write_raw(struct iio_dev *indio_dev,
         
     case IIO_CHAN_INFO_SCALE:
         /* We only allow changing the PGA setting */
+        if (state->autorange)
+            return -EBUSY;
         if (val != 3300 || val2 == 0)
             return -EINVAL;
             
@@ -456,194 +2251,1076 @@ static int cs1237_write_raw(struct iio_dev *indio_dev,
             
         break;
         
+    case IIO_CHAN_INFO_CALIBBIAS:
+        if (val < -cs1237_value_max(state) - 1 || val > cs1237_value_max(state))
+            return -EINVAL;
+        WRITE_ONCE(state->calibbias, val);
+        return 0;
+        
+    case IIO_CHAN_INFO_CALIBSCALE:
+        /* Up to 16x, applied from the next sample on */
+        if (val < 0 || val >= 16 || val2 < 0 || (!val && !val2))
+            return -EINVAL;
+        WRITE_ONCE(state->calibscale, val * MICRO + val2);
+        return 0;
+        
+    case IIO_CHAN_INFO_OFFSET:
+        if (val < -cs1237_value_max(state) - 1 || val > cs1237_value_max(state))
+            return -EINVAL;
+        WRITE_ONCE(state->offset, val);
+        return 0;
+        
+    case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+        /* Powers of two up to one output sample per second */
+        mutex_lock(&state->lock);
+        if (val < 1 || !is_power_of_2(val) || val > cs1237_osr_max(state->speed))
+            ret = -EINVAL;
+        else
+            WRITE_ONCE(state->osr, val);
+        mutex_unlock(&state->lock);
+        return ret;
+        
+    default:
+        return -EINVAL;
+    }
+    
+    ret = cs1237_pm_get(state);
+    if (ret)
+        return ret;
+    ret = cs1237_apply_config(state, speed_setting, pga_setting);
+    cs1237_pm_put(state);
+    
+    /* Keep the ratio valid for a lower rate */
+    mutex_lock(&state->lock);
+    if (!ret && state->osr > cs1237_osr_max(state->speed))
+        WRITE_ONCE(state->osr, cs1237_osr_max(state->speed));
+    mutex_unlock(&state->lock);
+    
+    return ret;
+}
+
+/* Change rate and/or gain, -1 keeps the current setting */
+static int cs1237_apply_config(struct cs1237_state *state, int speed_setting, int pga_setting)
+{
+    unsigned int seq;
+    u8 config_byte;
+    int ret;
+    
+    mutex_lock(&state->lock);
+    if (speed_setting < 0)
+        speed_setting = state->speed;
+    if (pga_setting < 0)
+        pga_setting = state->pga;
+    
+    if (state->running) {
+        /* Queue it for the acquisition work, applied at the next DRDY edge */
+        seq = READ_ONCE(state->config_seq);
+        atomic_set(&state->pending_config, cs1237_pack_config(speed_setting, pga_setting, 0, 0));
+        
+        ret = 0;
+        if (!wait_event_timeout(state->sample_wq, READ_ONCE(state->config_seq) != seq,
+                                cs1237_sample_timeout(state)) &&
+            atomic_xchg(&state->pending_config, -1) >= 0)
+            ret = -ETIMEDOUT;
+        mutex_unlock(&state->lock);
+        return ret;
+    }
+    
+    /* Stopped: write the chip directly */
+    cs1237_acq_pause(state);
+    config_byte = cs1237_pack_config(speed_setting, pga_setting, state->channel, state->refo);
+                 
+    ret = cs1237_write_config(state, config_byte);
+    if (ret) {
+        cs1237_acq_resume(state);
+        mutex_unlock(&state->lock);
+        return ret;
+    }
+    
+    state->speed = speed_setting;
+    state->pga = pga_setting;
+    state->settle_count = cs1237_settle_samples[state->speed];
+    cs1237_acq_resume(state);
+    mutex_unlock(&state->lock);
+    
+    return 0;
+}
+
+static int cs1237_read_avail(struct iio_dev *indio_dev,
+                           struct iio_chan_spec const *chan,
+                           const int **vals, int *type, int *length,
+                           long mask)
+{
+    static const int samp_freq_avail[] = {10, 40, 640, 1280};
+    static const int osr_avail[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    switch (mask) {
+    case IIO_CHAN_INFO_SAMP_FREQ:
+        *vals = samp_freq_avail;
+        *type = IIO_VAL_INT;
+        *length = ARRAY_SIZE(samp_freq_avail);
+        return IIO_AVAIL_LIST;
+    case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+        /* Only the ratios the current ODR allows */
+        *vals = osr_avail;
+        *type = IIO_VAL_INT;
+        *length = ilog2(cs1237_osr_max(state->speed)) + 1;
+        return IIO_AVAIL_LIST;
     default:
         return -EINVAL;
     }
+}
+
+
+static int cs1237_buffer_preenable(struct iio_dev *indio_dev)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int channel;
+    int ret;
+    
+    /* Keep sampling for as long as the buffer is enabled */
+    ret = cs1237_pm_get(state);
+    if (ret)
+        return ret;
+    
+    /* Switch the mux to whichever input the scan mask selects */
+    channel = (*indio_dev->active_scan_mask & BIT(1)) ? CS1237_CHANNEL_TEMP :
+                                                       CS1237_CHANNEL_A;
+    state->buffer_channel = channel;
+    
+    /* When multiplexing, only that input's samples are pushed */
+    if (READ_ONCE(state->temp_interval))
+        return 0;
+    
+    ret = cs1237_select_channel(state, channel);
+    if (ret)
+        cs1237_pm_put(state);
+    return ret;
+}
+
+static int cs1237_buffer_postdisable(struct iio_dev *indio_dev)
+{
+    cs1237_pm_put(iio_priv(indio_dev));
+    return 0;
+}
+
+static const struct iio_buffer_setup_ops cs1237_buffer_ops = {
+    .preenable = cs1237_buffer_preenable,
+    .postdisable = cs1237_buffer_postdisable,
+};
+
+static ssize_t cs1237_reset_store(struct device *dev,
+                                struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    u8 config_byte;
+    int ret;
+    
+    ret = cs1237_pm_get(state);
+    if (ret)
+        return ret;
+    
+    /* Power cycle the CS1237 by toggling SCK */
+    mutex_lock(&state->lock);
+    cs1237_acq_pause(state);
+    ret = cs1237_reset_device(state, &config_byte);
+    cs1237_acq_resume(state);
+    mutex_unlock(&state->lock);
+    cs1237_pm_put(state);
+    if (ret)
+        return ret;
+    
+    dev_info(state->dev, "CS1237 reset complete, config=0x%02x\n", config_byte);
+    
+    return count;
+}
+
+static ssize_t cs1237_running_show(struct device *dev,
+                                 struct device_attribute *attr,
+                                 char *buf)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    return sysfs_emit(buf, "%d\n", state->enabled ? 1 : 0);
+}
+
+static ssize_t cs1237_running_store(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    bool val;
+    int ret;
+    
+    ret = kstrtobool(buf, &val);
+    if (ret)
+        return ret;
+    
+    cs1237_set_enabled(state, val);
+    
+    return count;
+}
+
+static ssize_t cs1237_samples_show(struct device *dev,
+                                 struct device_attribute *attr,
+                                 char *buf)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    return sysfs_emit(buf, "%d\n", cs1237_sample_counter(state));
+}
+
+static ssize_t cs1237_mean_show(struct device *dev,
+                              struct device_attribute *attr,
+                              char *buf)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    unsigned int seq;
+    s64 sum;
+    int count;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        sum = state->sum;
+        count = state->samples_count;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    if (count == 0)
+        return sysfs_emit(buf, "0\n");
+    
+    return sysfs_emit(buf, "%lld\n", div_s64(sum, count));
+}
+
+static ssize_t cs1237_clear_stats_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    write_seqlock(&state->sample_lock);
+    state->sum = 0;
+    state->samples_count = 0;
+    cs1237_timing_reset(&state->latency);
+    cs1237_timing_reset(&state->xfer_time);
+    cs1237_timing_reset(&state->interval);
+    write_sequnlock(&state->sample_lock);
+    
+    return count;
+}
+
+/* Consistent copy of the window statistics */
+struct cs1237_window {
+    int count;
+    s64 sum;
+    u64 sumsq;
+    s32 min;
+    s32 max;
+};
+
+/* Inside a sample_lock read section */
+static void __cs1237_window_get(struct cs1237_state *state, struct cs1237_window *win)
+{
+    win->count = state->buffer_count;
+    win->sum = state->win_sum;
+    win->sumsq = state->win_sumsq;
+    win->min = state->win_min.len ? state->win_min.entries[state->win_min.head].value : 0;
+    win->max = state->win_max.len ? state->win_max.entries[state->win_max.head].value : 0;
+}
+
+static void cs1237_window_get(struct cs1237_state *state, struct cs1237_window *win)
+{
+    unsigned int seq;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        __cs1237_window_get(state, win);
+    } while (read_seqretry(&state->sample_lock, seq));
+}
+
+/*
+ * Sample variance in counts^2, from sumsq - sum^2 / n without overflow.
+ * sumsq wraps once n * max^2 passes 2^64 (autorange values have 31 bits);
+ * n * sumsq - sum^2 is still exact modulo 2^64, and is the actual
+ * n * sum((x - mean)^2), so it holds as long as the spread fits.
+ */
+static u64 cs1237_window_variance(struct cs1237_window *win)
+{
+    u64 peak = max(abs(win->min), abs(win->max));
+    u64 abs_sum = abs(win->sum);
+    u64 sq_mean;
+    
+    if (peak * peak > div_u64(U64_MAX, win->count))
+        return div64_u64((u64)win->count * win->sumsq - abs_sum * abs_sum,
+                         (u64)win->count * (win->count - 1));
+    
+    sq_mean = mul_u64_u64_div_u64(abs_sum, abs_sum, win->count);
+    if (win->sumsq <= sq_mean)
+        return 0;
+    return div_u64(win->sumsq - sq_mean, win->count - 1);
+}
+
+static ssize_t cs1237_window_min_show(struct device *dev,
+                                    struct device_attribute *attr,
+                                    char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    struct cs1237_window win;
+    
+    cs1237_window_get(state, &win);
+    if (!win.count)
+        return -EBUSY;
+    
+    return sysfs_emit(buf, "%d\n", win.min);
+}
+
+static ssize_t cs1237_window_max_show(struct device *dev,
+                                    struct device_attribute *attr,
+                                    char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    struct cs1237_window win;
+    
+    cs1237_window_get(state, &win);
+    if (!win.count)
+        return -EBUSY;
+    
+    return sysfs_emit(buf, "%d\n", win.max);
+}
+
+static ssize_t cs1237_window_mean_show(struct device *dev,
+                                     struct device_attribute *attr,
+                                     char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    struct cs1237_window win;
+    
+    cs1237_window_get(state, &win);
+    if (!win.count)
+        return -EBUSY;
+    
+    return sysfs_emit(buf, "%lld\n", div_s64(win.sum, win.count));
+}
+
+static ssize_t cs1237_window_variance_show(struct device *dev,
+                                         struct device_attribute *attr,
+                                         char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    struct cs1237_window win;
+    
+    cs1237_window_get(state, &win);
+    if (win.count < 2)
+        return -EBUSY;
+    
+    return sysfs_emit(buf, "%llu\n", cs1237_window_variance(&win));
+}
+
+/* Standard deviation in counts, with three decimals while it fits */
+static ssize_t cs1237_window_stddev_show(struct device *dev,
+                                       struct device_attribute *attr,
+                                       char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    struct cs1237_window win;
+    u64 var, milli;
+    
+    cs1237_window_get(state, &win);
+    if (win.count < 2)
+        return -EBUSY;
+    
+    var = cs1237_window_variance(&win);
+    if (var < U64_MAX / 1000000)
+        milli = int_sqrt64(var * 1000000);
+    else
+        milli = (u64)int_sqrt64(var) * 1000;
+    
+    return sysfs_emit(buf, "%llu.%03llu\n", div_u64(milli, 1000), milli % 1000);
+}
+
+/* Lifetime "count sum" of channel A, unaffected by cs1237_clear_stats */
+static ssize_t cs1237_totals_show(struct device *dev,
+                                struct device_attribute *attr,
+                                char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    unsigned int seq;
+    u64 count;
+    s64 sum;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        count = state->total_count;
+        sum = state->total_sum;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return sysfs_emit(buf, "%llu %lld\n", count, sum);
+}
+
+/*
+ * Channel A as one coherent record, all fields from the same sample:
+ * "seq time_ns raw filtered samples mean win_count win_min win_max win_mean
+ * win_variance". seq is the lifetime sample count, time_ns the DRDY edge
+ * (ktime_get_ns) of the latest sample. Like the other statistics this
+ * never wakes the chip nor waits; time_ns tells how old the record is.
+ */
+static ssize_t cs1237_snapshot_show(struct device *dev,
+                                  struct device_attribute *attr,
+                                  char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    struct cs1237_window win;
+    unsigned int seq;
+    u64 total, time_ns;
+    s32 raw, filtered;
+    s64 sum;
+    int count;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        total = state->total_count;
+        time_ns = state->chan_time_ns[CS1237_CHANNEL_A];
+        raw = state->chan_data[CS1237_CHANNEL_A];
+        filtered = state->filtered;
+        sum = state->sum;
+        count = state->samples_count;
+        __cs1237_window_get(state, &win);
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return sysfs_emit(buf, "%llu %llu %d %d %d %lld %d %d %d %lld %llu\n",
+                      total, time_ns, raw, filtered, count,
+                      count ? div_s64(sum, count) : 0,
+                      win.count, win.min, win.max,
+                      win.count ? div_s64(win.sum, win.count) : 0,
+                      win.count >= 2 ? cs1237_window_variance(&win) : 0);
+}
+
+/* Gain the chip converts at, changed by the driver itself under autorange */
+static ssize_t cs1237_gain_show(struct device *dev,
+                                struct device_attribute *attr,
+                                char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    
+    return sysfs_emit(buf, "%d\n", cs1237_pga_gains[READ_ONCE(state->pga)]);
+}
+
+static ssize_t cs1237_missed_show(struct device *dev,
+                                  struct device_attribute *attr,
+                                  char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
     
-    /* Apply new settings */
-    mutex_lock(&state->lock);
-    config_byte = (speed_setting & 0x03) |
-                 ((pga_setting & 0x03) << 2) |
-                 ((state->channel & 0x01) << 4) |
-                 ((state->refo & 0x01) << 5);
-                 
-    ret = cs1237_write_config(state, config_byte);
-    if (ret) {
-        mutex_unlock(&state->lock);
-        return ret;
-    }
+    return sysfs_emit(buf, "%u\n", READ_ONCE(state->missed));
+}
+
+static ssize_t cs1237_overruns_show(struct device *dev,
+                                    struct device_attribute *attr,
+                                    char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
     
-    state->speed = speed_setting;
-    state->pga = pga_setting;
-    mutex_unlock(&state->lock);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(state->overruns));
+}
+
+static ssize_t cs1237_resyncs_show(struct device *dev,
+                                   struct device_attribute *attr,
+                                   char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
     
-    return 0;
+    return sysfs_emit(buf, "%u\n", READ_ONCE(state->resyncs));
 }
 
-static int cs1237_read_avail(struct iio_dev *indio_dev,
-                           struct iio_chan_spec const *chan,
-                           const int **vals, int *type, int *length,
-                           long mask)
+static ssize_t cs1237_stuck_resets_show(struct device *dev,
+                                        struct device_attribute *attr,
+                                        char *buf)
 {
-    static const int samp_freq_avail[] = {10, 40, 640, 1280};
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
     
-    switch (mask) {
-    case IIO_CHAN_INFO_SAMP_FREQ:
-        *vals = samp_freq_avail;
-        *type = IIO_VAL_INT;
-        *length = ARRAY_SIZE(samp_freq_avail);
-        return IIO_AVAIL_LIST;
-    default:
-        return -EINVAL;
-    }
+    return sysfs_emit(buf, "%u\n", READ_ONCE(state->stuck_resets));
 }
 
+static ssize_t cs1237_latency_show(struct device *dev,
+                                 struct device_attribute *attr,
+                                 char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    
+    return cs1237_timing_show(state, &state->latency, buf);
+}
 
+static ssize_t cs1237_xfer_time_show(struct device *dev,
+                                   struct device_attribute *attr,
+                                   char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    
+    return cs1237_timing_show(state, &state->xfer_time, buf);
+}
 
-/* Buffer operations not implemented yet */
+static ssize_t cs1237_interval_show(struct device *dev,
+                                  struct device_attribute *attr,
+                                  char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    
+    return cs1237_timing_show(state, &state->interval, buf);
+}
 
-static ssize_t cs1237_reset_store(struct device *dev,
-                                struct device_attribute *attr,
-                                const char *buf, size_t count)
+static ssize_t cs1237_median_window_show(struct device *dev,
+                                        struct device_attribute *attr,
+                                        char *buf)
 {
     struct iio_dev *indio_dev = dev_to_iio_dev(dev);
     struct cs1237_state *state = iio_priv(indio_dev);
-    bool running;
-    u8 config_byte;
+    
+    return sysfs_emit(buf, "%d\n", state->median_window);
+}
+
+static ssize_t cs1237_median_window_store(struct device *dev,
+                                         struct device_attribute *attr,
+                                         const char *buf, size_t count)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int val;
     int ret;
     
-    /* Power cycle the CS1237 by toggling SCK */
-    mutex_lock(&state->lock);
-    running = state->running;
-    state->running = false;
-    mutex_unlock(&state->lock);
+    ret = kstrtoint(buf, 0, &val);
+    if (ret)
+        return ret;
     
-    msleep(10);
+    if (val < 1 || val > CS1237_MEDIAN_MAX || !(val & 1))
+        return -EINVAL;
     
-    /* Power up sequence */
-    gpiod_set_value(state->sck_gpio, 1);
-    msleep(1);
-    gpiod_set_value(state->sck_gpio, 0);
+    write_seqlock(&state->sample_lock);
+    state->median_window = val;
+    cs1237_filter_reset(state);
+    write_sequnlock(&state->sample_lock);
     
-    /* Wait for data ready */
-    if (!cs1237_wait_data_ready(state, 500)) {
-        dev_err(state->dev, "CS1237 reset failed: device did not respond\n");
-        return -EIO;
-    }
+    return count;
+}
+
+static ssize_t cs1237_average_window_show(struct device *dev,
+                                         struct device_attribute *attr,
+                                         char *buf)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
     
-    /* Reconfigure the device */
-    mutex_lock(&state->lock);
-    config_byte = (state->speed & 0x03) |
-                 ((state->pga & 0x03) << 2) |
-                 ((state->channel & 0x01) << 4) |
-                 ((state->refo & 0x01) << 5);
-                 
-    ret = cs1237_write_config(state, config_byte);
-    if (ret) {
-        mutex_unlock(&state->lock);
+    return sysfs_emit(buf, "%d\n", state->average_window);
+}
+
+static ssize_t cs1237_average_window_store(struct device *dev,
+                                          struct device_attribute *attr,
+                                          const char *buf, size_t count)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int val;
+    int ret;
+    
+    ret = kstrtoint(buf, 0, &val);
+    if (ret)
         return ret;
-    }
     
-    /* Verify configuration */
-    ret = cs1237_read_config(state, &config_byte);
-    if (ret) {
-        mutex_unlock(&state->lock);
+    if (val < 1 || val > CS1237_AVERAGE_MAX)
+        return -EINVAL;
+    
+    write_seqlock(&state->sample_lock);
+    state->average_window = val;
+    cs1237_filter_reset(state);
+    write_sequnlock(&state->sample_lock);
+    
+    return count;
+}
+
+static ssize_t cs1237_temp_interval_show(struct device *dev,
+                                        struct device_attribute *attr,
+                                        char *buf)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    return sysfs_emit(buf, "%d\n", READ_ONCE(state->temp_interval));
+}
+
+static ssize_t cs1237_temp_interval_store(struct device *dev,
+                                         struct device_attribute *attr,
+                                         const char *buf, size_t count)
+{
+    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int val;
+    int ret;
+    
+    ret = kstrtoint(buf, 0, &val);
+    if (ret)
         return ret;
-    }
     
-    state->running = running;
-    mutex_unlock(&state->lock);
+    if (val < 0)
+        return -EINVAL;
     
-    dev_info(state->dev, "CS1237 reset complete, config=0x%02x\n", config_byte);
+    /* Picked up by the acquisition work at the next conversion */
+    WRITE_ONCE(state->temp_interval, val);
     
     return count;
 }
 
-static ssize_t cs1237_running_show(struct device *dev,
+static ssize_t cs1237_temp_calibration_show(struct device *dev,
+                                           struct device_attribute *attr,
+                                           char *buf)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    unsigned int seq;
+    s32 raw;
+    int mdegc;
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        raw = state->temp_cal_raw;
+        mdegc = state->temp_cal_mdegc;
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return sysfs_emit(buf, "%d %d\n", raw, mdegc);
+}
+
+/* "raw mdegc": in_temp1_raw, at the current gain, read at mdegc milli-degC */
+static ssize_t cs1237_temp_calibration_store(struct device *dev,
+                                            struct device_attribute *attr,
+                                            const char *buf, size_t count)
+{
+    struct cs1237_state *state = iio_priv(dev_to_iio_dev(dev));
+    int raw, mdegc;
+    
+    if (sscanf(buf, "%d %d", &raw, &mdegc) != 2)
+        return -EINVAL;
+    /* 0 raw clears the calibration */
+    if (raw < 0 || mdegc <= -273150)
+        return -EINVAL;
+    
+    write_seqlock(&state->sample_lock);
+    state->temp_cal_raw = raw;
+    state->temp_cal_pga = READ_ONCE(state->pga);
+    state->temp_cal_mdegc = mdegc;
+    write_sequnlock(&state->sample_lock);
+    
+    return count;
+}
+
+static ssize_t cs1237_burst_show(struct device *dev,
                                  struct device_attribute *attr,
                                  char *buf)
 {
     struct iio_dev *indio_dev = dev_to_iio_dev(dev);
     struct cs1237_state *state = iio_priv(indio_dev);
     
-    return sysfs_emit(buf, "%d\n", state->running ? 1 : 0);
+    return sysfs_emit(buf, "%d\n", READ_ONCE(state->burst));
 }
 
-static ssize_t cs1237_running_store(struct device *dev,
+static ssize_t cs1237_burst_store(struct device *dev,
                                   struct device_attribute *attr,
                                   const char *buf, size_t count)
 {
     struct iio_dev *indio_dev = dev_to_iio_dev(dev);
     struct cs1237_state *state = iio_priv(indio_dev);
-    bool val;
+    int val;
     int ret;
     
-    ret = kstrtobool(buf, &val);
+    ret = kstrtoint(buf, 0, &val);
     if (ret)
         return ret;
     
+    if (val < 0 || val > CS1237_BURST_MAX)
+        return -EINVAL;
+    
+    /* Used from the next raw or filtered read on */
+    WRITE_ONCE(state->burst, val);
+    
+    return count;
+}
+
+/*
+ * Whole channel A history in one read(). A read at offset 0 of at least
+ * history_attr.size bytes is one consistent snapshot; smaller reads are
+ * slices of independent snapshots.
+ */
+static ssize_t cs1237_history_read(struct file *filp, struct kobject *kobj,
+                                   struct bin_attribute *attr, char *buf,
+                                   loff_t off, size_t count)
+{
+    struct cs1237_state *state = container_of(attr, struct cs1237_state, history_attr);
+    struct cs1237_history_header hdr;
+    size_t hdr_len, len;
+    unsigned int seq;
+    
+    if (off >= attr->size)
+        return 0;
+    count = min_t(size_t, count, attr->size - off);
+    
+    do {
+        seq = read_seqbegin(&state->sample_lock);
+        hdr.head = state->buffer_head;
+        hdr.count = state->buffer_count;
+        hdr.size = state->buffer_size;
+        hdr.total = state->buffer_total;
+        
+        len = 0;
+        if (off < sizeof(hdr)) {
+            hdr_len = min_t(size_t, count, sizeof(hdr) - off);
+            memcpy(buf, (u8 *)&hdr + off, hdr_len);
+            len = hdr_len;
+        }
+        if (len < count)
+            memcpy(buf + len, (u8 *)state->sample_buffer + off + len - sizeof(hdr),
+                   count - len);
+    } while (read_seqretry(&state->sample_lock, seq));
+    
+    return count;
+}
+
+/* One reader at a time: it gets a fresh ring and keeps the chip sampling */
+static int cs1237_capture_open(struct inode *inode, struct file *file)
+{
+    struct cs1237_state *state = container_of(file->private_data, struct cs1237_state,
+                                              capture_misc);
+    struct cs1237_capture_header *hdr;
+    size_t size;
+    int ret;
+    
+    size = PAGE_SIZE + PAGE_ALIGN(state->capture_records * sizeof(struct cs1237_capture_record));
+    hdr = vmalloc_user(size);
+    if (!hdr)
+        return -ENOMEM;
+    
+    hdr->magic = CS1237_CAPTURE_MAGIC;
+    hdr->record_size = sizeof(struct cs1237_capture_record);
+    hdr->records = state->capture_records;
+    hdr->data_offset = PAGE_SIZE;
+    hdr->watermark = 1;
+    
+    ret = cs1237_pm_get(state);
+    if (ret) {
+        vfree(hdr);
+        return ret;
+    }
+    
     mutex_lock(&state->lock);
-    state->running = val;
+    if (state->capture_map) {
+        mutex_unlock(&state->lock);
+        cs1237_pm_put(state);
+        vfree(hdr);
+        return -EBUSY;
+    }
+    state->capture_head = 0;
+    state->capture_map = hdr;
+    WRITE_ONCE(state->capture_ring, hdr);
     mutex_unlock(&state->lock);
     
-    return count;
+    /*
+     * Opens are serialised against misc_deregister(), so the state is still
+     * live here; the reference keeps it allocated until release
+     */
+    iio_device_get(state->indio_dev);
+    file->private_data = state;
+    return nonseekable_open(inode, file);
 }
 
-static ssize_t cs1237_samples_show(struct device *dev,
-                                 struct device_attribute *attr,
-                                 char *buf)
+/* Only called once every mapping is gone, so the ring can be freed */
+static int cs1237_capture_release(struct inode *inode, struct file *file)
 {
-    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
-    struct cs1237_state *state = iio_priv(indio_dev);
-    int samples;
+    struct cs1237_state *state = file->private_data;
+    struct cs1237_capture_header *hdr;
     
     mutex_lock(&state->lock);
-    samples = state->raw_counter;
+    hdr = state->capture_map;
+    state->capture_map = NULL;
+    /* After remove, the ring was already detached and the chip released */
+    if (!state->capture_dead) {
+        WRITE_ONCE(state->capture_ring, NULL);
+        /* Let a push that already saw the ring finish */
+        kthread_flush_work(&state->acq_work);
+        cs1237_pm_put(state);
+    }
     mutex_unlock(&state->lock);
     
-    return sysfs_emit(buf, "%d\n", samples);
+    vfree(hdr);
+    iio_device_put(state->indio_dev);
+    
+    return 0;
 }
 
-static ssize_t cs1237_mean_show(struct device *dev,
-                              struct device_attribute *attr,
-                              char *buf)
+static int cs1237_capture_mmap(struct file *file, struct vm_area_struct *vma)
 {
-    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
-    struct cs1237_state *state = iio_priv(indio_dev);
-    s64 sum;
-    int count;
+    struct cs1237_state *state = file->private_data;
+    int ret;
     
     mutex_lock(&state->lock);
-    sum = state->sum;
-    count = state->samples_count;
+    if (state->capture_dead)
+        ret = -ENODEV;
+    else
+        ret = remap_vmalloc_range(vma, state->capture_map, vma->vm_pgoff);
     mutex_unlock(&state->lock);
     
-    if (count == 0)
-        return sysfs_emit(buf, "0\n");
+    return ret;
+}
+
+static __poll_t cs1237_capture_poll(struct file *file, poll_table *wait)
+{
+    struct cs1237_state *state = file->private_data;
+    struct cs1237_capture_header *hdr = state->capture_map;
+    bool dead;
+    
+    poll_wait(file, &state->capture_wq, wait);
+    
+    mutex_lock(&state->lock);
+    dead = state->capture_dead;
+    mutex_unlock(&state->lock);
+    if (dead)
+        return EPOLLHUP | EPOLLERR;
+    
+    if (READ_ONCE(state->capture_head) - READ_ONCE(hdr->tail) >=
+        max(READ_ONCE(hdr->watermark), 1U))
+        return EPOLLIN | EPOLLRDNORM;
+    return 0;
+}
+
+static const struct file_operations cs1237_capture_fops = {
+    .owner = THIS_MODULE,
+    .open = cs1237_capture_open,
+    .release = cs1237_capture_release,
+    .mmap = cs1237_capture_mmap,
+    .poll = cs1237_capture_poll,
+};
+
+static void cs1237_capture_remove(void *data)
+{
+    struct cs1237_state *state = data;
+    
+    /* No new opens once this returns, but a file may still be open */
+    misc_deregister(&state->capture_misc);
+    
+    mutex_lock(&state->lock);
+    state->capture_dead = true;
+    if (state->capture_map) {
+        WRITE_ONCE(state->capture_ring, NULL);
+        kthread_flush_work(&state->acq_work);
+        cs1237_pm_put(state);
+    }
+    mutex_unlock(&state->lock);
+    
+    /* Pollers see the hangup */
+    wake_up_interruptible(&state->capture_wq);
+}
+
+static void cs1237_history_remove(void *data)
+{
+    struct cs1237_state *state = data;
+    
+    device_remove_bin_file(&state->indio_dev->dev, &state->history_attr);
+}
+
+#ifdef CS1237_BENCH
+/*
+ * Transport benchmark, built by "make bench": writing "read <n>" or
+ * "config <n>" to debugfs cs1237/iio:deviceX/bench runs n data reads or
+ * config register writes with acquisition paused, reading it back reports
+ * the last run. Each transaction waits for DRDY first, so the wall time per
+ * transaction is a whole conversion cycle and the achieved rate is what the
+ * transport keeps up with at the current sampling_frequency.
+ */
+#define CS1237_BENCH_MAX         100000
+
+enum {
+    CS1237_BENCH_READ,
+    CS1237_BENCH_CONFIG,
+};
+
+static const char * const cs1237_bench_ops[] = {
+    [CS1237_BENCH_READ] = "read",
+    [CS1237_BENCH_CONFIG] = "config",
+};
+
+/* Acquisition paused and lock held */
+static int cs1237_bench_run(struct cs1237_state *state, int op, u32 n)
+{
+    struct cs1237_bench *bench = &state->bench;
+    u8 config_byte = cs1237_config_byte(state, state->channel);
+    u64 start_ns, cpu_ns, xfer_ns;
+    s32 value;
+    u32 i;
+    int ret = 0;
+    
+    memset(bench, 0, sizeof(*bench));
+    bench->op = op;
+    
+    /*
+     * The runtime is brought up to date whenever the task sleeps, which
+     * the DRDY wait does on every transaction
+     */
+    cpu_ns = current->se.sum_exec_runtime;
+    start_ns = ktime_get_ns();
+    
+    for (i = 0; i < n; i++) {
+        if (fatal_signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+        
+        if (!cs1237_wait_data_ready(state, 500)) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        
+        xfer_ns = ktime_get_ns();
+        if (op == CS1237_BENCH_READ)
+            ret = cs1237_read_raw_value(state, &value);
+        else
+            ret = state->ops->config_xfer(state, CS1237_CMD_WRITE_REG, &config_byte, NULL);
+        if (ret)
+            break;
+        cs1237_timing_add(&bench->xfer, ktime_get_ns() - xfer_ns);
+    }
+    
+    bench->wall_ns = ktime_get_ns() - start_ns;
+    bench->cpu_ns = current->se.sum_exec_runtime - cpu_ns;
+    
+    /* A config write restarts the conversion, like a reset */
+    if (op == CS1237_BENCH_CONFIG)
+        state->settle_count = cs1237_settle_samples[state->speed];
+    
+    return ret;
+}
+
+static int cs1237_bench_show(struct seq_file *s, void *unused)
+{
+    struct cs1237_state *state = s->private;
+    struct cs1237_bench *bench = &state->bench;
+    struct cs1237_timing *t = &bench->xfer;
+    u64 rate;
+    
+    mutex_lock(&state->lock);
+    seq_printf(s, "transport: %s%s\n", state->ops->name,
+               state->sck_din ? " (batched SCK/DIN)" : "");
+    if (t->count) {
+        /* Transactions per second, in thousandths */
+        rate = div64_u64((u64)t->count * NSEC_PER_SEC * 1000, bench->wall_ns);
+        
+        seq_printf(s, "op: %s\n", cs1237_bench_ops[bench->op]);
+        seq_printf(s, "count: %u\n", t->count);
+        seq_printf(s, "xfer_ns: %llu %llu %llu %llu\n", t->min, t->max,
+                   div_u64(t->sum, t->count), cs1237_timing_p99(t));
+        seq_printf(s, "cycle_ns: %llu\n", div_u64(bench->wall_ns, t->count));
+        seq_printf(s, "samples_per_s: %llu.%03llu\n", div_u64(rate, 1000), rate % 1000);
+        seq_printf(s, "cpu_ns: %llu %llu\n", bench->cpu_ns, div_u64(bench->cpu_ns, t->count));
+    }
+    mutex_unlock(&state->lock);
+    
+    return 0;
+}
+
+static int cs1237_bench_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, cs1237_bench_show, inode->i_private);
+}
+
+static ssize_t cs1237_bench_write(struct file *file, const char __user *ubuf,
+                                  size_t len, loff_t *ppos)
+{
+    struct cs1237_state *state = ((struct seq_file *)file->private_data)->private;
+    char buf[32], *arg, *name;
+    u32 n;
+    int op, ret;
+    
+    if (len >= sizeof(buf))
+        return -EINVAL;
+    if (copy_from_user(buf, ubuf, len))
+        return -EFAULT;
+    buf[len] = '\0';
+    
+    arg = strim(buf);
+    name = strsep(&arg, " ");
+    op = match_string(cs1237_bench_ops, ARRAY_SIZE(cs1237_bench_ops), name);
+    if (op < 0 || !arg || kstrtou32(skip_spaces(arg), 0, &n) || !n || n > CS1237_BENCH_MAX)
+        return -EINVAL;
+    
+    ret = cs1237_pm_get(state);
+    if (ret)
+        return ret;
+    
+    mutex_lock(&state->lock);
+    cs1237_acq_pause(state);
+    ret = cs1237_bench_run(state, op, n);
+    cs1237_acq_resume(state);
+    mutex_unlock(&state->lock);
+    cs1237_pm_put(state);
+    
+    return ret ? ret : len;
+}
+
+static const struct file_operations cs1237_bench_fops = {
+    .owner = THIS_MODULE,
+    .open = cs1237_bench_open,
+    .read = seq_read,
+    .write = cs1237_bench_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static void cs1237_debugfs_remove(void *data)
+{
+    struct cs1237_state *state = data;
     
-    return sysfs_emit(buf, "%lld\n", div_s64(sum, count));
+    debugfs_remove_recursive(state->debugfs);
 }
 
-static ssize_t cs1237_clear_stats_store(struct device *dev,
-                                      struct device_attribute *attr,
-                                      const char *buf, size_t count)
+static int cs1237_debugfs_init(struct cs1237_state *state)
 {
-    struct iio_dev *indio_dev = dev_to_iio_dev(dev);
-    struct cs1237_state *state = iio_priv(indio_dev);
-    
-    mutex_lock(&state->lock);
-    state->sum = 0;
-    state->samples_count = 0;
-    mutex_unlock(&state->lock);
+    state->debugfs = debugfs_create_dir(dev_name(&state->indio_dev->dev), cs1237_debugfs);
+    debugfs_create_file("bench", 0600, state->debugfs, state, &cs1237_bench_fops);
     
-    return count;
+    return devm_add_action_or_reset(state->dev, cs1237_debugfs_remove, state);
+}
+#else
+static inline int cs1237_debugfs_init(struct cs1237_state *state)
+{
+    return 0;
 }
+#endif
 
 static IIO_DEVICE_ATTR_WO(cs1237_reset, 0);
 static IIO_DEVICE_ATTR_RW(cs1237_running, 0);
 static IIO_DEVICE_ATTR_RO(cs1237_samples, 0);
 static IIO_DEVICE_ATTR_RO(cs1237_mean, 0);
 static IIO_DEVICE_ATTR_WO(cs1237_clear_stats, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_window_min, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_window_max, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_window_mean, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_window_variance, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_window_stddev, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_totals, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_gain, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_snapshot, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_missed, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_overruns, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_resyncs, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_stuck_resets, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_latency, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_xfer_time, 0);
+static IIO_DEVICE_ATTR_RO(cs1237_interval, 0);
+static IIO_DEVICE_ATTR_RW(cs1237_median_window, 0);
+static IIO_DEVICE_ATTR_RW(cs1237_average_window, 0);
+static IIO_DEVICE_ATTR_RW(cs1237_temp_interval, 0);
+static IIO_DEVICE_ATTR_RW(cs1237_temp_calibration, 0);
+static IIO_DEVICE_ATTR_RW(cs1237_burst, 0);
 
 static struct attribute *cs1237_attributes[] = {
     &iio_dev_attr_cs1237_reset.dev_attr.attr,
@@ -651,6 +3328,26 @@ static struct attribute *cs1237_attributes[] = {
     &iio_dev_attr_cs1237_samples.dev_attr.attr,
     &iio_dev_attr_cs1237_mean.dev_attr.attr,
     &iio_dev_attr_cs1237_clear_stats.dev_attr.attr,
+    &iio_dev_attr_cs1237_window_min.dev_attr.attr,
+    &iio_dev_attr_cs1237_window_max.dev_attr.attr,
+    &iio_dev_attr_cs1237_window_mean.dev_attr.attr,
+    &iio_dev_attr_cs1237_window_variance.dev_attr.attr,
+    &iio_dev_attr_cs1237_window_stddev.dev_attr.attr,
+    &iio_dev_attr_cs1237_totals.dev_attr.attr,
+    &iio_dev_attr_cs1237_gain.dev_attr.attr,
+    &iio_dev_attr_cs1237_snapshot.dev_attr.attr,
+    &iio_dev_attr_cs1237_missed.dev_attr.attr,
+    &iio_dev_attr_cs1237_overruns.dev_attr.attr,
+    &iio_dev_attr_cs1237_resyncs.dev_attr.attr,
+    &iio_dev_attr_cs1237_stuck_resets.dev_attr.attr,
+    &iio_dev_attr_cs1237_latency.dev_attr.attr,
+    &iio_dev_attr_cs1237_xfer_time.dev_attr.attr,
+    &iio_dev_attr_cs1237_interval.dev_attr.attr,
+    &iio_dev_attr_cs1237_median_window.dev_attr.attr,
+    &iio_dev_attr_cs1237_average_window.dev_attr.attr,
+    &iio_dev_attr_cs1237_temp_interval.dev_attr.attr,
+    &iio_dev_attr_cs1237_temp_calibration.dev_attr.attr,
+    &iio_dev_attr_cs1237_burst.dev_attr.attr,
     NULL
 };
 
@@ -658,55 +3355,207 @@ static const struct attribute_group cs1237_attribute_group = {
     .attrs = cs1237_attributes,
 };
 
+static int cs1237_event_index(enum iio_event_direction dir)
+{
+    return dir == IIO_EV_DIR_RISING ? 0 : 1;
+}
+
+static int cs1237_read_event_config(struct iio_dev *indio_dev,
+                                    const struct iio_chan_spec *chan,
+                                    enum iio_event_type type,
+                                    enum iio_event_direction dir)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    return READ_ONCE(state->ev_enabled[cs1237_event_index(dir)]);
+}
+
+/* An enabled event keeps the chip sampling, like a reader would */
+static int cs1237_write_event_config(struct iio_dev *indio_dev,
+                                     const struct iio_chan_spec *chan,
+                                     enum iio_event_type type,
+                                     enum iio_event_direction dir,
+                                     bool enable)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int idx = cs1237_event_index(dir);
+    bool was_enabled;
+    int ret;
+    
+    /* Taken outside the lock, runtime resume needs it */
+    if (enable) {
+        ret = cs1237_pm_get(state);
+        if (ret)
+            return ret;
+    }
+    
+    mutex_lock(&state->lock);
+    was_enabled = state->ev_enabled[idx];
+    if (enable && !was_enabled)
+        WRITE_ONCE(state->ev_armed[idx], true);
+    WRITE_ONCE(state->ev_enabled[idx], enable);
+    mutex_unlock(&state->lock);
+    
+    /* One reference per enabled event */
+    if (was_enabled)
+        cs1237_pm_put(state);
+    
+    return 0;
+}
+
+static int cs1237_read_event_value(struct iio_dev *indio_dev,
+                                   const struct iio_chan_spec *chan,
+                                   enum iio_event_type type,
+                                   enum iio_event_direction dir,
+                                   enum iio_event_info info,
+                                   int *val, int *val2)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int idx = cs1237_event_index(dir);
+    
+    switch (info) {
+    case IIO_EV_INFO_VALUE:
+        *val = READ_ONCE(state->ev_thresh[idx]);
+        return IIO_VAL_INT;
+    case IIO_EV_INFO_HYSTERESIS:
+        *val = READ_ONCE(state->ev_hyst[idx]);
+        return IIO_VAL_INT;
+    default:
+        return -EINVAL;
+    }
+}
+
+static int cs1237_write_event_value(struct iio_dev *indio_dev,
+                                    const struct iio_chan_spec *chan,
+                                    enum iio_event_type type,
+                                    enum iio_event_direction dir,
+                                    enum iio_event_info info,
+                                    int val, int val2)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    int idx = cs1237_event_index(dir);
+    
+    /* Raw counts, on the in_voltage0_filtered_raw scale */
+    switch (info) {
+    case IIO_EV_INFO_VALUE:
+        if (val < -cs1237_value_max(state) - 1 || val > cs1237_value_max(state))
+            return -EINVAL;
+        WRITE_ONCE(state->ev_thresh[idx], val);
+        return 0;
+    case IIO_EV_INFO_HYSTERESIS:
+        if (val < 0 || val > 2 * cs1237_value_max(state) + 1)
+            return -EINVAL;
+        WRITE_ONCE(state->ev_hyst[idx], val);
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
 static const struct iio_info cs1237_info = {
     .attrs = &cs1237_attribute_group,
     .read_raw = cs1237_read_raw,
     .write_raw = cs1237_write_raw,
     .read_avail = cs1237_read_avail,
+    .read_event_config = cs1237_read_event_config,
+    .write_event_config = cs1237_write_event_config,
+    .read_event_value = cs1237_read_event_value,
+    .write_event_value = cs1237_write_event_value,
+    .validate_trigger = iio_validate_own_trigger,
 };
 
-static int cs1237_probe(struct platform_device *pdev)
+static const struct iio_trigger_ops cs1237_trigger_ops = {
+    .validate_device = iio_trigger_validate_own_device,
+};
+
+/*
+ * Runtime PM: with no reader and no buffer for the autosuspend delay,
+ * acquisition stops and SCK is held high, which powers the chip down.
+ * On SPI the bus owns SCK, so only sampling stops.
+ */
+static int cs1237_runtime_suspend(struct device *dev)
 {
-    struct device *dev = &pdev->dev;
-    struct cs1237_state *state;
-    struct iio_dev *indio_dev;
-    u8 config_byte, read_config;
-    int ret;
+    struct cs1237_state *state = iio_priv(dev_get_drvdata(dev));
+    
+    mutex_lock(&state->lock);
+    state->suspended = true;
+    cs1237_update_running(state);
+    mutex_unlock(&state->lock);
+    cs1237_drdy_sync(state);
+    kthread_flush_work(&state->acq_work);
+    
+    /* Readers wait for fresh conversions after resume */
+    write_seqlock(&state->sample_lock);
+    state->chan_count[CS1237_CHANNEL_A] = 0;
+    state->chan_count[CS1237_CHANNEL_TEMP] = 0;
+    cs1237_filter_reset(state);
+    write_sequnlock(&state->sample_lock);
+    
+    if (state->ops->set_sck)
+        state->ops->set_sck(state, 1);
+    
+    return 0;
+}
 
-    dev_info(dev, "Probing CS1237 ADC ...\n");
+static int cs1237_runtime_resume(struct device *dev)
+{
+    struct cs1237_state *state = iio_priv(dev_get_drvdata(dev));
+    
+    /* SCK low wakes the chip, its settings are kept while powered down */
+    if (state->ops->set_sck)
+        state->ops->set_sck(state, 0);
+    
+    mutex_lock(&state->lock);
+    state->suspended = false;
+    state->settle_count = cs1237_settle_samples[state->speed];
+    cs1237_update_running(state);
+    mutex_unlock(&state->lock);
+    
+    return 0;
+}
 
-    indio_dev = devm_iio_device_alloc(dev, sizeof(*state));
-    if (!indio_dev)
-        return -ENOMEM;
+static DEFINE_RUNTIME_DEV_PM_OPS(cs1237_pm_ops, cs1237_runtime_suspend,
+                                 cs1237_runtime_resume, NULL);
+
+/* Bus independent part of probe, state->ops and the GPIOs are set up */
+static int cs1237_probe_common(struct device *dev, struct iio_dev *indio_dev)
+{
+    struct cs1237_state *state = iio_priv(indio_dev);
+    u8 config_byte, read_config;
+    u32 autosuspend_ms;
+    u32 cal[2];
+    int ret;
     
-    state = iio_priv(indio_dev);
     state->dev = dev;
+    state->indio_dev = indio_dev;
     mutex_init(&state->lock);
-    
-    /* Get GPIO descriptors */
-    state->sck_gpio = devm_gpiod_get(dev, "sck", GPIOD_OUT_LOW);
-    if (IS_ERR(state->sck_gpio)){
-        dev_err(dev, "Failed to get SCK GPIO\n");
-        return PTR_ERR(state->sck_gpio);
-    }
-        
-    state->dout_gpio = devm_gpiod_get(dev, "dout", GPIOD_IN);
-    if (IS_ERR(state->dout_gpio)){
-        dev_err(dev, "Failed to get DOUT GPIO\n");
-        return PTR_ERR(state->dout_gpio);
-    }
-
-    state->din_gpio = devm_gpiod_get(dev, "din", GPIOD_OUT_LOW);
-    if (IS_ERR(state->din_gpio)) {
-        dev_err(dev, "Failed to get DIN GPIO\n");
-        return PTR_ERR(state->din_gpio);
-    }
+    mutex_init(&state->burst_lock);
+    seqlock_init(&state->sample_lock);
+    init_waitqueue_head(&state->sample_wq);
+    init_waitqueue_head(&state->capture_wq);
+    atomic_set(&state->pending_config, -1);
+    kthread_init_work(&state->acq_work, cs1237_acq_work);
+    INIT_DELAYED_WORK(&state->watchdog, cs1237_watchdog_work);
+    spin_lock_init(&state->poll_lock);
+    /* Starts masked, like the IRQ requested with IRQF_NO_AUTOEN */
+    state->poll_depth = 1;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&state->poll_timer, cs1237_poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+#else
+    /* hrtimer_setup() is 6.13+, Raspberry Pi kernels are still 6.12 */
+    hrtimer_init(&state->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+    state->poll_timer.function = cs1237_poll_timer;
+#endif
     
     /* Get device properties */
     ret = device_property_read_u32(dev, "chipsea,pga", &state->pga);
     if (ret)
         state->pga = CS1237_PGA_1; /* Default PGA = 1 */
     
+    /* Starts from chipsea,pga, which then only sets the first gain */
+    state->autorange = device_property_read_bool(dev, "chipsea,autorange");
+    state->range_pga = state->pga;
+    
     ret = device_property_read_u32(dev, "chipsea,speed", &state->speed);
     if (ret)
         state->speed = CS1237_SPEED_10HZ; /* Default speed = 10Hz */
@@ -719,10 +3568,48 @@ static int cs1237_probe(struct platform_device *pdev)
     if (ret)
         state->refo = CS1237_REFO_DISABLE; /* Default refo = disabled */
     
+    ret = device_property_read_u32(dev, "chipsea,temp-interval", &state->temp_interval);
+    if (ret)
+        state->temp_interval = 0; /* Default no multiplexing */
+    
+    /* <raw mdegc>, raw read at chipsea,pga; uncalibrated if absent */
+    if (!device_property_read_u32_array(dev, "chipsea,temp-calibration", cal, 2) &&
+        (s32)cal[0] > 0 && (s32)cal[1] > -273150) {
+        state->temp_cal_raw = cal[0];
+        state->temp_cal_pga = state->pga;
+        state->temp_cal_mdegc = cal[1];
+    }
+    
+    state->calibscale = MICRO;
+    
+    ret = device_property_read_u32(dev, "chipsea,oversampling-ratio", &state->osr);
+    if (ret || state->osr < 1 || !is_power_of_2(state->osr) ||
+        state->osr > cs1237_osr_max(state->speed))
+        state->osr = 1; /* Default no decimation */
+    
+    ret = device_property_read_u32(dev, "chipsea,capture-records", &state->capture_records);
+    if (ret || !state->capture_records)
+        state->capture_records = CS1237_CAPTURE_RECORDS;
+    state->capture_records = roundup_pow_of_two(min(state->capture_records, 1U << 24));
+    
+    ret = device_property_read_u32(dev, "chipsea,autosuspend-delay-ms", &autosuspend_ms);
+    if (ret)
+        autosuspend_ms = CS1237_AUTOSUSPEND_MS;
+    
+    ret = device_property_read_u32(dev, "chipsea,burst", &state->burst);
+    if (ret || state->burst < 0 || state->burst > CS1237_BURST_MAX)
+        state->burst = 0; /* Default continuous */
+    
     /* Initialize buffer */
     ret = device_property_read_u32(dev, "chipsea,buffer-size", &state->buffer_size);
     if (ret || state->buffer_size <= 0)
         state->buffer_size = 20; /* Default buffer size */
+    if (state->buffer_size > CS1237_BUFFER_MAX) {
+        /* sysfs hands out one page per read(), the history must fit in it */
+        dev_warn(dev, "buffer-size %d too large, using %lu\n", state->buffer_size,
+                 (unsigned long)CS1237_BUFFER_MAX);
+        state->buffer_size = CS1237_BUFFER_MAX;
+    }
     
     state->sample_buffer = devm_kmalloc_array(dev, state->buffer_size,
                                             sizeof(*state->sample_buffer),
@@ -730,24 +3617,43 @@ static int cs1237_probe(struct platform_device *pdev)
     if (!state->sample_buffer)
         return -ENOMEM;
     
+    state->win_min.entries = devm_kcalloc(dev, state->buffer_size,
+                                          sizeof(*state->win_min.entries), GFP_KERNEL);
+    state->win_max.entries = devm_kcalloc(dev, state->buffer_size,
+                                          sizeof(*state->win_max.entries), GFP_KERNEL);
+    if (!state->win_min.entries || !state->win_max.entries)
+        return -ENOMEM;
+    
+    /* Initialize filter, by default a median of 5 averaged over the buffer */
+    ret = device_property_read_u32(dev, "chipsea,median-window", &state->median_window);
+    if (ret || state->median_window < 1 || state->median_window > CS1237_MEDIAN_MAX ||
+        !(state->median_window & 1))
+        state->median_window = CS1237_MEDIAN_DEFAULT;
+    
+    ret = device_property_read_u32(dev, "chipsea,average-window", &state->average_window);
+    if (ret || state->average_window < 1 || state->average_window > CS1237_AVERAGE_MAX)
+        state->average_window = min(state->buffer_size, CS1237_AVERAGE_MAX);
+    
     /* Initialize IIO device */
     indio_dev->name = "cs1237";
     indio_dev->dev.parent = dev;
     indio_dev->info = &cs1237_info;
     indio_dev->modes = INDIO_DIRECT_MODE;
-    indio_dev->channels = cs1237_channels;
-    indio_dev->num_channels = ARRAY_SIZE(cs1237_channels);
+    if (state->autorange) {
+        indio_dev->channels = cs1237_autorange_channels;
+        indio_dev->num_channels = ARRAY_SIZE(cs1237_autorange_channels);
+    } else {
+        indio_dev->channels = cs1237_channels;
+        indio_dev->num_channels = ARRAY_SIZE(cs1237_channels);
+    }
+    indio_dev->available_scan_masks = cs1237_scan_masks;
 
     // ret = iio_device_register_sysfs_group(indio_dev, &cs1237_attribute_group);
     // if (ret)
     //     return ret;
     
-    platform_set_drvdata(pdev, indio_dev);
-    
     /* Power up sequence */
-    gpiod_set_value(state->sck_gpio, 1);
-    msleep(1);
-    gpiod_set_value(state->sck_gpio, 0);
+    cs1237_power_up(state);
     
     /* Wait for data ready */
     if (!cs1237_wait_data_ready(state, 500)) {
@@ -756,10 +3662,8 @@ static int cs1237_probe(struct platform_device *pdev)
     }
     
     /* Configure the device */
-    config_byte = (state->speed & 0x03) |
-                 ((state->pga & 0x03) << 2) |
-                 ((state->channel & 0x01) << 4) |
-                 ((state->refo & 0x01) << 5);
+    config_byte = cs1237_config_byte(state, state->channel);
+    state->settle_count = cs1237_settle_samples[state->speed];
                  
     ret = cs1237_write_config(state, config_byte);
     if (ret) {
@@ -779,43 +3683,247 @@ static int cs1237_probe(struct platform_device *pdev)
     
     dev_info(dev, "Config byte: 0x%02X, Read config: 0x%02X", config_byte, read_config);
     
-    /* Start conversion thread */
-    state->conv_task = kthread_run(cs1237_conv_thread, state, "cs1237-conv");
-    if (IS_ERR(state->conv_task)) {
-        ret = PTR_ERR(state->conv_task);
-        dev_err(dev, "Failed to create conversion thread, error %d\n", ret);
+    /* DOUT falling edge signals data ready, DOUT is polled without an IRQ */
+    state->irq = -ENXIO;
+    if (!device_property_read_bool(dev, "chipsea,drdy-poll"))
+        state->irq = gpiod_to_irq(state->dout_gpio);
+    if (state->irq == -EPROBE_DEFER)
+        return state->irq;
+    
+    if (state->irq < 0) {
+        dev_info(dev, "No data-ready IRQ (error %d), polling DOUT\n", state->irq);
+        state->poll = true;
+    } else {
+        ret = devm_request_irq(dev, state->irq, cs1237_drdy_irq,
+                               IRQF_TRIGGER_FALLING | IRQF_NO_AUTOEN,
+                               "cs1237-drdy", indio_dev);
+        if (ret) {
+            dev_err(dev, "Failed to request data-ready IRQ, error %d\n", ret);
+            return ret;
+        }
+    }
+    
+    /* Data-ready trigger, fired from the acquisition work once a sample is read */
+    state->trig = devm_iio_trigger_alloc(dev, "%s-dev%d", indio_dev->name,
+                                         iio_device_id(indio_dev));
+    if (!state->trig)
+        return -ENOMEM;
+    
+    state->trig->ops = &cs1237_trigger_ops;
+    iio_trigger_set_drvdata(state->trig, indio_dev);
+    
+    ret = devm_iio_trigger_register(dev, state->trig);
+    if (ret) {
+        dev_err(dev, "Failed to register trigger, error %d\n", ret);
+        return ret;
+    }
+    
+    indio_dev->trig = iio_trigger_get(state->trig);
+    
+    ret = devm_iio_triggered_buffer_setup(dev, indio_dev, NULL,
+                                          cs1237_trigger_handler,
+                                          &cs1237_buffer_ops);
+    if (ret) {
+        dev_err(dev, "Failed to setup triggered buffer, error %d\n", ret);
+        return ret;
+    }
+    
+    /* Held until registered, then dropped to let the chip autosuspend */
+    pm_runtime_set_active(dev);
+    pm_runtime_get_noresume(dev);
+    ret = devm_pm_runtime_enable(dev);
+    if (ret) {
+        pm_runtime_put_noidle(dev);
         return ret;
     }
+    pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
+    pm_runtime_use_autosuspend(dev);
     
     /* Start data acquisition */
-    state->running = true;
+    cs1237_set_enabled(state, true);
     
     ret = devm_iio_device_register(dev, indio_dev);
     if (ret) {
         dev_err(dev, "Failed to register IIO device, error %d\n", ret);
-        kthread_stop(state->conv_task);
+        cs1237_set_enabled(state, false);
+        cs1237_drdy_sync(state);
+        cancel_delayed_work_sync(&state->watchdog);
+        kthread_cancel_work_sync(&state->acq_work);
+        pm_runtime_put_noidle(dev);
         return ret;
     }
     
-    dev_info(dev, "CS1237 24-bit ADC driver initialized");
+    /* IIO only registers plain attributes, add the history blob by hand */
+    sysfs_bin_attr_init(&state->history_attr);
+    state->history_attr.attr.name = "cs1237_history";
+    state->history_attr.attr.mode = 0444;
+    state->history_attr.size = sizeof(struct cs1237_history_header) +
+                               state->buffer_size * sizeof(*state->sample_buffer);
+    state->history_attr.read = cs1237_history_read;
+    ret = device_create_bin_file(&indio_dev->dev, &state->history_attr);
+    if (!ret)
+        ret = devm_add_action_or_reset(dev, cs1237_history_remove, state);
+    if (ret)
+        dev_warn(dev, "Failed to create history attribute, error %d\n", ret);
+    
+    /* Zero-copy capture ring, /dev/cs1237-capN for iio:deviceN */
+    snprintf(state->capture_name, sizeof(state->capture_name), "cs1237-cap%d",
+             iio_device_id(indio_dev));
+    state->capture_misc.minor = MISC_DYNAMIC_MINOR;
+    state->capture_misc.name = state->capture_name;
+    state->capture_misc.fops = &cs1237_capture_fops;
+    state->capture_misc.parent = dev;
+    ret = misc_register(&state->capture_misc);
+    if (!ret)
+        ret = devm_add_action_or_reset(dev, cs1237_capture_remove, state);
+    if (ret)
+        dev_warn(dev, "Failed to register capture device, error %d\n", ret);
+    
+    ret = cs1237_debugfs_init(state);
+    if (ret)
+        dev_warn(dev, "Failed to create debugfs entries, error %d\n", ret);
+    
+    pm_runtime_mark_last_busy(dev);
+    pm_runtime_put_autosuspend(dev);
+    
+    dev_info(dev, "CS1237 24-bit ADC driver initialized (%s transport)", state->ops->name);
     return 0;
 }
 
+static int cs1237_probe(struct platform_device *pdev)
+{
+    struct device *dev = &pdev->dev;
+    struct cs1237_state *state;
+    struct iio_dev *indio_dev;
+
+    dev_info(dev, "Probing CS1237 ADC ...\n");
+
+    indio_dev = devm_iio_device_alloc(dev, sizeof(*state));
+    if (!indio_dev)
+        return -ENOMEM;
+    
+    state = iio_priv(indio_dev);
+    state->ops = &cs1237_gpio_ops;
+    
+    state->dev = dev;
+    
+    /* Get GPIO descriptors, SCK and DIN either as one array or one by one */
+    state->sck_din = devm_gpiod_get_array_optional(dev, "sck-din", GPIOD_OUT_LOW);
+    if (IS_ERR(state->sck_din)) {
+        dev_err(dev, "Failed to get SCK/DIN GPIO array\n");
+        return PTR_ERR(state->sck_din);
+    }
+    
+    if (state->sck_din) {
+        if (state->sck_din->ndescs != 2) {
+            dev_err(dev, "sck-din-gpios needs exactly SCK and DIN\n");
+            return -EINVAL;
+        }
+        state->sck_gpio = state->sck_din->desc[0];
+        state->din_gpio = state->sck_din->desc[1];
+    } else {
+        state->sck_gpio = devm_gpiod_get(dev, "sck", GPIOD_OUT_LOW);
+        if (IS_ERR(state->sck_gpio)){
+            dev_err(dev, "Failed to get SCK GPIO\n");
+            return PTR_ERR(state->sck_gpio);
+        }
+        
+        state->din_gpio = devm_gpiod_get(dev, "din", GPIOD_OUT_LOW);
+        if (IS_ERR(state->din_gpio)) {
+            dev_err(dev, "Failed to get DIN GPIO\n");
+            return PTR_ERR(state->din_gpio);
+        }
+    }
+        
+    state->dout_gpio = devm_gpiod_get(dev, "dout", GPIOD_IN);
+    if (IS_ERR(state->dout_gpio)){
+        dev_err(dev, "Failed to get DOUT GPIO\n");
+        return PTR_ERR(state->dout_gpio);
+    }
+    
+    cs1237_gpio_setup_timing(state);
+    
+    platform_set_drvdata(pdev, indio_dev);
+    
+    return cs1237_probe_common(dev, indio_dev);
+}
+
 static void cs1237_remove(struct platform_device *pdev)
 {
     struct iio_dev *indio_dev = platform_get_drvdata(pdev);
     struct cs1237_state *state = iio_priv(indio_dev);
     
-    /* Stop data acquisition */
-    state->running = false;
-    
-    /* Stop and clean up the conversion thread */
-    if (state->conv_task)
-        kthread_stop(state->conv_task);
+    /* Stop data acquisition, the IRQ itself is released by devm */
+    cs1237_set_enabled(state, false);
+    cs1237_drdy_sync(state);
+    cancel_delayed_work_sync(&state->watchdog);
+    kthread_cancel_work_sync(&state->acq_work);
     
     return;
 }
 
+#if IS_ENABLED(CONFIG_SPI)
+static int cs1237_spi_probe(struct spi_device *spi)
+{
+    struct device *dev = &spi->dev;
+    struct cs1237_state *state;
+    struct iio_dev *indio_dev;
+    int ret;
+
+    dev_info(dev, "Probing CS1237 ADC on SPI ...\n");
+
+    indio_dev = devm_iio_device_alloc(dev, sizeof(*state));
+    if (!indio_dev)
+        return -ENOMEM;
+    
+    state = iio_priv(indio_dev);
+    state->ops = &cs1237_spi_ops;
+    state->spi = spi;
+    
+    /* DOUT is sampled on the falling edge, SCK must idle low */
+    spi->mode = SPI_MODE_1;
+    if (!spi->max_speed_hz)
+        spi->max_speed_hz = 1000000;
+    ret = spi_setup(spi);
+    if (ret) {
+        dev_err(dev, "Failed to setup SPI device, error %d\n", ret);
+        return ret;
+    }
+    
+    state->spi_read_bpw = cs1237_spi_pick_bpw(spi, cs1237_spi_read_bpw,
+                                              ARRAY_SIZE(cs1237_spi_read_bpw));
+    state->spi_config_bpw = cs1237_spi_pick_bpw(spi, cs1237_spi_config_bpw,
+                                                ARRAY_SIZE(cs1237_spi_config_bpw));
+    if (!state->spi_read_bpw || !state->spi_config_bpw) {
+        dev_err(dev, "SPI controller can not send %d and %d clock frames\n",
+                CS1237_READ_CLOCKS, CS1237_CONFIG_CLOCKS);
+        return -EINVAL;
+    }
+    
+    /* Same pin as MISO, only used as input to sense DRDY */
+    state->dout_gpio = devm_gpiod_get(dev, "dout", GPIOD_ASIS);
+    if (IS_ERR(state->dout_gpio)){
+        dev_err(dev, "Failed to get DOUT GPIO\n");
+        return PTR_ERR(state->dout_gpio);
+    }
+    
+    spi_set_drvdata(spi, indio_dev);
+    
+    return cs1237_probe_common(dev, indio_dev);
+}
+
+static void cs1237_spi_remove(struct spi_device *spi)
+{
+    struct iio_dev *indio_dev = spi_get_drvdata(spi);
+    struct cs1237_state *state = iio_priv(indio_dev);
+    
+    cs1237_set_enabled(state, false);
+    cs1237_drdy_sync(state);
+    cancel_delayed_work_sync(&state->watchdog);
+    kthread_cancel_work_sync(&state->acq_work);
+}
+#endif
+
 #ifdef CONFIG_OF
 static const struct of_device_id cs1237_dt_ids[] = {
     { .compatible = "chipsea,cs1237", },
@@ -828,12 +3936,108 @@ static struct platform_driver cs1237_driver = {
     .driver = {
         .name   = "cs1237",
         .of_match_table = of_match_ptr(cs1237_dt_ids),
+        .pm     = pm_ptr(&cs1237_pm_ops),
     },
     .probe  = cs1237_probe,
     .remove = cs1237_remove,
 };
 
-module_platform_driver(cs1237_driver);
+#if IS_ENABLED(CONFIG_SPI)
+static const struct spi_device_id cs1237_spi_ids[] = {
+    { "cs1237", 0 },
+    { }
+};
+MODULE_DEVICE_TABLE(spi, cs1237_spi_ids);
+
+static struct spi_driver cs1237_spi_driver = {
+    .driver = {
+        .name   = "cs1237",
+        .of_match_table = of_match_ptr(cs1237_dt_ids),
+        .pm     = pm_ptr(&cs1237_pm_ops),
+    },
+    .id_table = cs1237_spi_ids,
+    .probe  = cs1237_spi_probe,
+    .remove = cs1237_spi_remove,
+};
+#endif
+
+/* The same compatible binds as a platform (GPIO) or an SPI device */
+static int __init cs1237_init(void)
+{
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = SCHED_FIFO,
+        .sched_priority = acq_priority,
+    };
+    int ret;
+    
+    if (acq_priority < 0 || acq_priority >= MAX_RT_PRIO ||
+        acq_cpu < -1 || acq_cpu >= (int)nr_cpu_ids)
+        return -EINVAL;
+    
+    cs1237_worker = kthread_create_worker(0, "cs1237-acq");
+    if (IS_ERR(cs1237_worker))
+        return PTR_ERR(cs1237_worker);
+    
+#ifdef CS1237_BENCH
+    cs1237_debugfs = debugfs_create_dir("cs1237", NULL);
+#endif
+    
+    /*
+     * Real-time by default, the same latency class as the threaded IRQ
+     * handlers it replaces, so a busy system does not delay the reads
+     */
+    if (acq_priority) {
+        ret = sched_setattr_nocheck(cs1237_worker->task, &attr);
+        if (ret)
+            goto err_worker;
+    }
+    
+    if (acq_cpu >= 0) {
+        ret = set_cpus_allowed_ptr(cs1237_worker->task, cpumask_of(acq_cpu));
+        if (ret)
+            goto err_worker;
+    }
+    
+    ret = platform_driver_register(&cs1237_driver);
+    if (ret)
+        goto err_worker;
+    
+#if IS_ENABLED(CONFIG_SPI)
+    ret = spi_register_driver(&cs1237_spi_driver);
+    if (ret) {
+        platform_driver_unregister(&cs1237_driver);
+        goto err_worker;
+    }
+#endif
+    
+    return 0;
+    
+err_worker:
+#ifdef CS1237_BENCH
+    debugfs_remove_recursive(cs1237_debugfs);
+#endif
+    kthread_destroy_worker(cs1237_worker);
+    return ret;
+}
+module_init(cs1237_init);
+
+static void __exit cs1237_exit(void)
+{
+#if IS_ENABLED(CONFIG_SPI)
+    spi_unregister_driver(&cs1237_spi_driver);
+#endif
+    platform_driver_unregister(&cs1237_driver);
+#ifdef CS1237_BENCH
+    debugfs_remove_recursive(cs1237_debugfs);
+#endif
+    kthread_destroy_worker(cs1237_worker);
+}
+module_exit(cs1237_exit);
+
+#ifdef CS1237_KUNIT
+#include "cs1237_kunit.c"
+#endif
 
 MODULE_AUTHOR("Denis");
 MODULE_DESCRIPTION("Chipsea CS1237 24-bit ADC driver");
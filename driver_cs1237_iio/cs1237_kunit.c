@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the CS1237 driver
+ *
+ * Copyright (C) 2025 Denis
+ *
+ * Included at the end of cs1237.c when built with CS1237_KUNIT=y, so the
+ * static helpers can be called directly. The bit-bang transport runs
+ * against an emulated chip plugged in through cs1237_line_ops, no GPIO or
+ * hardware is needed.
+ */
+
+#include <kunit/test.h>
+
+/* Deterministic sample stream, positive and negative, with outliers */
+static s32 cs1237_test_value(u32 *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return (s32)(*seed >> 8) - (1 << 23);
+}
+
+static void cs1237_test_sort(s32 *v, int n)
+{
+    int i, j;
+    
+    for (i = 1; i < n; i++)
+        for (j = i; j > 0 && v[j - 1] > v[j]; j--)
+            swap(v[j - 1], v[j]);
+}
+
+static void cs1237_filter_fill_test(struct kunit *test)
+{
+    struct cs1237_state *state = kunit_kzalloc(test, sizeof(*state), GFP_KERNEL);
+    
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    state->median_window = 3;
+    state->average_window = 1;
+    cs1237_filter_reset(state);
+    
+    cs1237_filter_push(state, 10);
+    KUNIT_EXPECT_EQ(test, state->filtered, 10);
+    /* Even while filling: mean of the two middle samples */
+    cs1237_filter_push(state, 1000);
+    KUNIT_EXPECT_EQ(test, state->filtered, 505);
+    cs1237_filter_push(state, 12);
+    KUNIT_EXPECT_EQ(test, state->filtered, 12);
+    /* The 10 leaves the window */
+    cs1237_filter_push(state, 14);
+    KUNIT_EXPECT_EQ(test, state->filtered, 14);
+    
+    /* Boxcar alone, a median window of one passes samples through */
+    state->median_window = 1;
+    state->average_window = 4;
+    cs1237_filter_reset(state);
+    cs1237_filter_push(state, 4);
+    cs1237_filter_push(state, 8);
+    cs1237_filter_push(state, 12);
+    cs1237_filter_push(state, 16);
+    KUNIT_EXPECT_EQ(test, state->filtered, 10);
+    cs1237_filter_push(state, 20);
+    KUNIT_EXPECT_EQ(test, state->filtered, 14);
+    cs1237_filter_push(state, -100);
+    KUNIT_EXPECT_EQ(test, state->filtered, -13);
+}
+
+/* Incremental median + boxcar against a full sort of each window */
+static void cs1237_filter_stream_test(struct kunit *test)
+{
+    struct cs1237_state *state = kunit_kzalloc(test, sizeof(*state), GFP_KERNEL);
+    s32 samples[64], medians[64], window[CS1237_MEDIAN_MAX];
+    u32 seed = 1;
+    int i, j, n, m;
+    s64 sum;
+    
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    state->median_window = 5;
+    state->average_window = 3;
+    cs1237_filter_reset(state);
+    
+    for (i = 0; i < ARRAY_SIZE(samples); i++) {
+        samples[i] = cs1237_test_value(&seed);
+        cs1237_filter_push(state, samples[i]);
+    
+        n = min(i + 1, state->median_window);
+        memcpy(window, &samples[i + 1 - n], n * sizeof(*window));
+        cs1237_test_sort(window, n);
+        for (j = 0; j < n; j++)
+            KUNIT_EXPECT_EQ(test, state->median_sorted[j], window[j]);
+        medians[i] = n & 1 ? window[n / 2] :
+                     (s32)div_s64((s64)window[n / 2 - 1] + window[n / 2], 2);
+    
+        m = min(i + 1, state->average_window);
+        sum = 0;
+        for (j = i + 1 - m; j <= i; j++)
+            sum += medians[j];
+        KUNIT_EXPECT_EQ(test, state->filtered, (s32)div_s64(sum, m));
+    }
+}
+
+static void cs1237_timing_bucket_test(struct kunit *test)
+{
+    unsigned int idx;
+    u64 ns;
+    
+    /* Exact below 2^CS1237_HIST_SUB_BITS */
+    for (ns = 0; ns < BIT(CS1237_HIST_SUB_BITS); ns++) {
+        KUNIT_EXPECT_EQ(test, cs1237_timing_bucket(ns), ns);
+        KUNIT_EXPECT_EQ(test, cs1237_timing_bucket_max(ns), ns);
+    }
+    
+    /* Buckets tile the range: each ends right where the next one starts */
+    for (idx = 0; idx < CS1237_HIST_BUCKETS - 1; idx++) {
+        ns = cs1237_timing_bucket_max(idx);
+        KUNIT_EXPECT_EQ(test, cs1237_timing_bucket(ns), idx);
+        KUNIT_EXPECT_EQ(test, cs1237_timing_bucket(ns + 1), idx + 1);
+    }
+    
+    /* Four sub-buckets per power of two: 896-1023 is one of them */
+    KUNIT_EXPECT_EQ(test, cs1237_timing_bucket(896), cs1237_timing_bucket(1023));
+    KUNIT_EXPECT_NE(test, cs1237_timing_bucket(895), cs1237_timing_bucket(896));
+    KUNIT_EXPECT_NE(test, cs1237_timing_bucket(1023), cs1237_timing_bucket(1024));
+    
+    /* Everything too long lands in the last bucket */
+    KUNIT_EXPECT_EQ(test, cs1237_timing_bucket(U64_MAX), CS1237_HIST_BUCKETS - 1);
+}
+
+static void cs1237_timing_p99_test(struct kunit *test)
+{
+    struct cs1237_timing *t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+    u64 p99;
+    int i;
+    
+    KUNIT_ASSERT_NOT_NULL(test, t);
+    KUNIT_EXPECT_EQ(test, cs1237_timing_p99(t), 0);
+    
+    for (i = 0; i < 100; i++)
+        cs1237_timing_add(t, 40000);
+    cs1237_timing_add(t, 5000000);
+    
+    p99 = cs1237_timing_p99(t);
+    KUNIT_EXPECT_GE(test, p99, 40000);
+    KUNIT_EXPECT_LE(test, p99, 40000 + 40000 / 4);
+    KUNIT_EXPECT_EQ(test, t->min, 40000);
+    KUNIT_EXPECT_EQ(test, t->max, 5000000);
+    
+    /* Never above the largest duration actually seen */
+    cs1237_timing_reset(t);
+    cs1237_timing_add(t, 1000);
+    KUNIT_EXPECT_EQ(test, cs1237_timing_p99(t), 1000);
+}
+
+/* Window extremes from the deques against a scan of the window */
+static void cs1237_deque_test(struct kunit *test)
+{
+    struct cs1237_deque min_dq = {}, max_dq = {};
+    s32 values[100];
+    const int size = 8;
+    u32 seed = 7;
+    s32 lo, hi;
+    int pos, j;
+    
+    min_dq.entries = kunit_kcalloc(test, size, sizeof(*min_dq.entries), GFP_KERNEL);
+    max_dq.entries = kunit_kcalloc(test, size, sizeof(*max_dq.entries), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, min_dq.entries);
+    KUNIT_ASSERT_NOT_NULL(test, max_dq.entries);
+    
+    for (pos = 0; pos < ARRAY_SIZE(values); pos++) {
+        /* Runs of equal and sorted values exercise the pops at the back */
+        values[pos] = pos % 20 < 10 ? cs1237_test_value(&seed) : (s32)(pos % 20) - 15;
+        cs1237_deque_push(&min_dq, size, pos, values[pos], false);
+        cs1237_deque_push(&max_dq, size, pos, values[pos], true);
+    
+        lo = hi = values[pos];
+        for (j = max(0, pos + 1 - size); j < pos; j++) {
+            lo = min(lo, values[j]);
+            hi = max(hi, values[j]);
+        }
+        KUNIT_EXPECT_EQ(test, min_dq.entries[min_dq.head].value, lo);
+        KUNIT_EXPECT_EQ(test, max_dq.entries[max_dq.head].value, hi);
+        KUNIT_EXPECT_LE(test, min_dq.len, size);
+        KUNIT_EXPECT_LE(test, max_dq.len, size);
+    }
+}
+
+#if IS_ENABLED(CONFIG_SPI)
+static void cs1237_spi_pack_test(struct kunit *test)
+{
+    static const struct {
+        unsigned int nbits;
+        const u8 *bpw;
+        int n;
+    } cases[] = {
+        { CS1237_READ_CLOCKS, cs1237_spi_read_bpw, ARRAY_SIZE(cs1237_spi_read_bpw) },
+        { CS1237_CONFIG_CLOCKS, cs1237_spi_config_bpw, ARRAY_SIZE(cs1237_spi_config_bpw) },
+    };
+    u8 buf[48];
+    u16 words[3];
+    u64 tx;
+    int i, j;
+    
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        tx = 0x123456789abcULL & (BIT_ULL(cases[i].nbits) - 1);
+        for (j = 0; j < cases[i].n; j++) {
+            u8 bpw = cases[i].bpw[j];
+    
+            KUNIT_ASSERT_EQ(test, cases[i].nbits % bpw, 0);
+            KUNIT_ASSERT_LE(test, cases[i].nbits / bpw * cs1237_spi_word_size(bpw),
+                            sizeof(buf));
+            cs1237_spi_pack(buf, cases[i].nbits, bpw, tx);
+            KUNIT_EXPECT_EQ(test, cs1237_spi_unpack(buf, cases[i].nbits, bpw), tx);
+        }
+    }
+    
+    /* 27 clocks as three 9 bit words, MSB first, in 16 bit slots */
+    cs1237_spi_pack(words, 27, 9, (0x1abULL << 18) | (0x055 << 9) | 0x1ff);
+    KUNIT_EXPECT_EQ(test, words[0], 0x1ab);
+    KUNIT_EXPECT_EQ(test, words[1], 0x055);
+    KUNIT_EXPECT_EQ(test, words[2], 0x1ff);
+    
+    /* Bits the controller leaves above the word size are not data */
+    words[0] = 0xffff;
+    KUNIT_EXPECT_EQ(test, cs1237_spi_unpack(words, 9, 9), 0x1ff);
+}
+#endif
+
+static void cs1237_range_normalise_test(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, cs1237_range_normalise(CS1237_PGA_128, -5), -5);
+    KUNIT_EXPECT_EQ(test, cs1237_range_normalise(CS1237_PGA_64, 1000), 2000);
+    KUNIT_EXPECT_EQ(test, cs1237_range_normalise(CS1237_PGA_2, 1000), 64000);
+    KUNIT_EXPECT_EQ(test, cs1237_range_normalise(CS1237_PGA_1, 1), 128);
+    /* Full scale at x1 still fits the 31 bit range */
+    KUNIT_EXPECT_EQ(test, cs1237_range_normalise(CS1237_PGA_1, -(1 << 23)), -(1 << 30));
+    KUNIT_EXPECT_EQ(test, cs1237_range_normalise(CS1237_PGA_1, (1 << 23) - 1),
+                    ((1 << 23) - 1) * 128);
+}
+
+static void cs1237_autorange_test(struct kunit *test)
+{
+    struct cs1237_state *state = kunit_kzalloc(test, sizeof(*state), GFP_KERNEL);
+    int i;
+    
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    
+    /* Near full scale steps down at once */
+    state->range_pga = CS1237_PGA_128;
+    cs1237_autorange(state, CS1237_PGA_128, -(7 << 20));
+    KUNIT_EXPECT_EQ(test, state->range_pga, CS1237_PGA_64);
+    cs1237_autorange(state, CS1237_PGA_1, 7 << 20);
+    KUNIT_EXPECT_EQ(test, state->range_pga, CS1237_PGA_1);
+    
+    /* Stepping up waits for CS1237_RANGE_HOLD quiet samples */
+    state->range_pga = CS1237_PGA_1;
+    for (i = 0; i < CS1237_RANGE_HOLD - 1; i++)
+        cs1237_autorange(state, CS1237_PGA_1, 1000);
+    KUNIT_EXPECT_EQ(test, state->range_pga, CS1237_PGA_1);
+    cs1237_autorange(state, CS1237_PGA_1, -1000);
+    KUNIT_EXPECT_EQ(test, state->range_pga, CS1237_PGA_128);
+    
+    /* ...to the highest gain keeping the peak below half scale */
+    state->range_pga = CS1237_PGA_1;
+    for (i = 0; i < CS1237_RANGE_HOLD; i++)
+        cs1237_autorange(state, CS1237_PGA_1, i ? 1000 : 1 << 16);
+    KUNIT_EXPECT_EQ(test, state->range_pga, CS1237_PGA_2);
+    
+    /* A loud sample restarts the count */
+    state->range_pga = CS1237_PGA_1;
+    for (i = 0; i < CS1237_RANGE_HOLD - 1; i++)
+        cs1237_autorange(state, CS1237_PGA_1, 1000);
+    cs1237_autorange(state, CS1237_PGA_1, 1 << 22);
+    KUNIT_EXPECT_EQ(test, state->range_hold, 0);
+    KUNIT_EXPECT_EQ(test, state->range_pga, CS1237_PGA_1);
+}
+
+/*
+ * Emulated chip on the SCK/DIN/DOUT lines. Clocks are counted from 1 on
+ * SCK rising edges: DOUT presents data bit 24 - n on clock n, is pulled
+ * high on clock 27 (or resync_clocks later), and carries register bits on
+ * clocks 38-45 of a read, until clock 46. DIN is inverted on the board, the chip latches
+ * !din on the falling edge of clocks 30-36 (command) and 38-45 (data).
+ */
+struct cs1237_emu {
+    struct cs1237_state state;
+    u32 data;
+    u8 reg;
+    /* DOUT reads answered busy (high) before the conversion is ready */
+    int ready_polls;
+    int resync_clocks;
+    
+    int sck;
+    int din;
+    int dout;
+    int clocks;
+    u8 cmd;
+    u8 written;
+    /* Bit n: DIN high at the rising edge of clock n, DOUT read during clock n */
+    u64 din_high;
+    u64 sampled;
+    /* SCK clocked while the chip still reported busy */
+    bool early;
+};
+
+static struct cs1237_emu *cs1237_to_emu(struct cs1237_state *state)
+{
+    return container_of(state, struct cs1237_emu, state);
+}
+
+static void cs1237_emu_set_sck(struct cs1237_state *state, int value)
+{
+    struct cs1237_emu *emu = cs1237_to_emu(state);
+    int n;
+    
+    if (value == emu->sck)
+        return;
+    emu->sck = value;
+    
+    if (value) {
+        if (emu->ready_polls)
+            emu->early = true;
+        n = ++emu->clocks;
+        if (emu->din)
+            emu->din_high |= BIT_ULL(n);
+        if (n <= 24)
+            emu->dout = (emu->data >> (24 - n)) & 1;
+        else if (n >= 27 && n < 38)
+            emu->dout = n >= 27 + emu->resync_clocks;
+        else if (n >= 38 && n <= 45 && emu->cmd == CS1237_CMD_READ_REG)
+            emu->dout = (emu->reg >> (45 - n)) & 1;
+        else if (n == 46)
+            emu->dout = 1;
+        return;
+    }
+    
+    n = emu->clocks;
+    if (n >= 30 && n <= 36)
+        emu->cmd = (emu->cmd << 1) | !emu->din;
+    if (n >= 38 && n <= 45 && emu->cmd == CS1237_CMD_WRITE_REG) {
+        emu->written = (emu->written << 1) | !emu->din;
+        if (n == 45)
+            emu->reg = emu->written;
+    }
+}
+
+static void cs1237_emu_set_din(struct cs1237_state *state, int value)
+{
+    cs1237_to_emu(state)->din = value;
+}
+
+static int cs1237_emu_get_dout(struct cs1237_state *state)
+{
+    struct cs1237_emu *emu = cs1237_to_emu(state);
+    
+    if (!emu->clocks && emu->ready_polls) {
+        emu->ready_polls--;
+        return 1;
+    }
+    
+    emu->sampled |= BIT_ULL(emu->clocks);
+    return emu->dout;
+}
+
+static const struct cs1237_line_ops cs1237_emu_lines = {
+    .set_sck = cs1237_emu_set_sck,
+    .set_din = cs1237_emu_set_din,
+    .get_dout = cs1237_emu_get_dout,
+};
+
+static struct cs1237_emu *cs1237_emu_alloc(struct kunit *test)
+{
+    struct cs1237_emu *emu = kunit_kzalloc(test, sizeof(*emu), GFP_KERNEL);
+    
+    KUNIT_ASSERT_NOT_NULL(test, emu);
+    emu->state.ops = &cs1237_gpio_ops;
+    emu->state.lines = &cs1237_emu_lines;
+    return emu;
+}
+
+/* Start a new transaction: conversion ready, nothing clocked yet */
+static void cs1237_emu_ready(struct cs1237_emu *emu, u32 data, int ready_polls)
+{
+    emu->data = data;
+    emu->ready_polls = ready_polls;
+    emu->dout = 0;
+    emu->clocks = 0;
+    emu->cmd = 0;
+    emu->written = 0;
+    emu->din_high = 0;
+    emu->sampled = 0;
+    emu->early = false;
+}
+
+static void cs1237_gpio_read_test(struct kunit *test)
+{
+    struct cs1237_emu *emu = cs1237_emu_alloc(test);
+    s32 value;
+    u32 raw;
+    
+    /* Asymmetric pattern, a reversed bit order would not match */
+    cs1237_emu_ready(emu, 0x812345, 0);
+    KUNIT_ASSERT_EQ(test, cs1237_gpio_read_sample(&emu->state, &raw), 0);
+    KUNIT_EXPECT_EQ(test, raw, 0x812345);
+    KUNIT_EXPECT_EQ(test, emu->clocks, CS1237_READ_CLOCKS);
+    /* 24 data bits read while SCK is high, then the DOUT high check */
+    KUNIT_EXPECT_EQ(test, emu->sampled, GENMASK_ULL(24, 1) | BIT_ULL(27));
+    /* DIN low for the whole read, the chip is not listening */
+    KUNIT_EXPECT_EQ(test, emu->din_high, 0);
+    KUNIT_EXPECT_EQ(test, emu->sck, 0);
+    KUNIT_EXPECT_EQ(test, emu->state.resyncs, 0);
+    
+    /* Sign extension goes through the same transaction */
+    cs1237_emu_ready(emu, 0x800001, 0);
+    KUNIT_ASSERT_EQ(test, cs1237_read_raw_value(&emu->state, &value), 0);
+    KUNIT_EXPECT_EQ(test, value, -8388607);
+    
+    /* DOUT still low after clock 27 takes extra clocks, counted as resync */
+    cs1237_emu_ready(emu, 0x000001, 0);
+    emu->resync_clocks = 2;
+    KUNIT_ASSERT_EQ(test, cs1237_gpio_read_sample(&emu->state, &raw), 0);
+    KUNIT_EXPECT_EQ(test, raw, 1);
+    KUNIT_EXPECT_EQ(test, emu->clocks, CS1237_READ_CLOCKS + 2);
+    KUNIT_EXPECT_EQ(test, emu->state.resyncs, 1);
+    
+    /* No conversion ready: no clock at all */
+    cs1237_emu_ready(emu, 0, 1);
+    KUNIT_EXPECT_EQ(test, cs1237_read_raw_value(&emu->state, &value), -EBUSY);
+    KUNIT_EXPECT_EQ(test, emu->clocks, 0);
+}
+
+static void cs1237_gpio_config_test(struct kunit *test)
+{
+    struct cs1237_emu *emu = cs1237_emu_alloc(test);
+    u8 config = cs1237_pack_config(CS1237_SPEED_640HZ, CS1237_PGA_128, CS1237_CHANNEL_A, 0);
+    u32 raw;
+    
+    /* Write: the conversion clocked out first, then command and data on DIN */
+    cs1237_emu_ready(emu, 0xa5a5a5, 0);
+    KUNIT_ASSERT_EQ(test, cs1237_gpio_config_xfer(&emu->state, CS1237_CMD_WRITE_REG,
+                                                  &config, &raw), 0);
+    KUNIT_EXPECT_EQ(test, raw, 0xa5a5a5);
+    KUNIT_EXPECT_EQ(test, emu->clocks, CS1237_CONFIG_CLOCKS);
+    KUNIT_EXPECT_EQ(test, emu->cmd, CS1237_CMD_WRITE_REG);
+    KUNIT_EXPECT_EQ(test, emu->reg, config);
+    /* DIN only driven on clocks 30-36 and 38-45, and released afterwards */
+    KUNIT_EXPECT_EQ(test, emu->din_high & ~(GENMASK_ULL(36, 30) | GENMASK_ULL(45, 38)), 0);
+    KUNIT_EXPECT_EQ(test, emu->din, 0);
+    KUNIT_EXPECT_EQ(test, emu->sampled, GENMASK_ULL(24, 1));
+    
+    /* Read: DIN released after the command, register bits sampled on DOUT */
+    cs1237_emu_ready(emu, 0x5a5a5a, 0);
+    emu->reg = 0x3c;
+    config = 0;
+    KUNIT_ASSERT_EQ(test, cs1237_gpio_config_xfer(&emu->state, CS1237_CMD_READ_REG,
+                                                  &config, &raw), 0);
+    KUNIT_EXPECT_EQ(test, config, 0x3c);
+    KUNIT_EXPECT_EQ(test, raw, 0x5a5a5a);
+    KUNIT_EXPECT_EQ(test, emu->clocks, CS1237_CONFIG_CLOCKS);
+    KUNIT_EXPECT_EQ(test, emu->cmd, CS1237_CMD_READ_REG);
+    KUNIT_EXPECT_EQ(test, emu->din_high & ~GENMASK_ULL(36, 30), 0);
+    KUNIT_EXPECT_EQ(test, emu->sampled, GENMASK_ULL(24, 1) | GENMASK_ULL(45, 38));
+    KUNIT_EXPECT_EQ(test, emu->din, 0);
+}
+
+static void cs1237_gpio_ready_test(struct kunit *test)
+{
+    struct cs1237_emu *emu = cs1237_emu_alloc(test);
+    u8 config;
+    
+    /* The config access only starts clocking once DOUT went low */
+    cs1237_emu_ready(emu, 0, 3);
+    KUNIT_ASSERT_EQ(test, cs1237_write_config(&emu->state, 0x2a), 0);
+    KUNIT_EXPECT_EQ(test, emu->ready_polls, 0);
+    KUNIT_EXPECT_FALSE(test, emu->early);
+    KUNIT_EXPECT_EQ(test, emu->reg, 0x2a);
+    
+    cs1237_emu_ready(emu, 0, 2);
+    KUNIT_ASSERT_EQ(test, cs1237_read_config(&emu->state, &config), 0);
+    KUNIT_EXPECT_FALSE(test, emu->early);
+    KUNIT_EXPECT_EQ(test, config, 0x2a);
+    
+    /* A chip that never gets ready times out without a single clock */
+    cs1237_emu_ready(emu, 0, INT_MAX);
+    KUNIT_EXPECT_FALSE(test, cs1237_wait_data_ready(&emu->state, 5));
+    KUNIT_EXPECT_EQ(test, emu->clocks, 0);
+}
+
+static struct kunit_case cs1237_test_cases[] = {
+    KUNIT_CASE(cs1237_filter_fill_test),
+    KUNIT_CASE(cs1237_filter_stream_test),
+    KUNIT_CASE(cs1237_timing_bucket_test),
+    KUNIT_CASE(cs1237_timing_p99_test),
+    KUNIT_CASE(cs1237_deque_test),
+#if IS_ENABLED(CONFIG_SPI)
+    KUNIT_CASE(cs1237_spi_pack_test),
+#endif
+    KUNIT_CASE(cs1237_range_normalise_test),
+    KUNIT_CASE(cs1237_autorange_test),
+    KUNIT_CASE(cs1237_gpio_read_test),
+    KUNIT_CASE(cs1237_gpio_config_test),
+    KUNIT_CASE(cs1237_gpio_ready_test),
+    {}
+};
+
+static struct kunit_suite cs1237_test_suite = {
+    .name = "cs1237",
+    .test_cases = cs1237_test_cases,
+};
+kunit_test_suite(cs1237_test_suite);
@@ -54,6 +54,19 @@ export interface Measurement {
 	sensor_id?: number | null;
 }
 
+// One bucket of /measurements/aggregate, resolution is the bucket width in seconds
+export interface MeasurementAggregate {
+	sensor_id: number;
+	measurement_type: MeasurementType;
+	unit: string;
+	timestamp: string;
+	resolution: number;
+	count: number;
+	mean: number;
+	min: number;
+	max: number;
+}
+
 export type MeasurementType = 'temperature' | 'humidity' | 'ph' | 'orp' | 'ec' | 'pressure' | 'water_level';
 
 export interface Controller {
@@ -113,6 +126,23 @@ export const api = {
 			const query = queryParams.toString() ? `?${queryParams.toString()}` : '';
 			return fetchApi<Measurement[]>(`/api/sensors/${id}/measurements${query}`);
 		},
+		getAggregates: (id: number, params?: {
+			start_time?: string;
+			end_time?: string;
+			points?: number;
+			resolution?: 'auto' | 'raw' | '60' | '3600';
+			measurement_type?: string;
+		}) => {
+			const queryParams = new URLSearchParams();
+			if (params?.start_time) queryParams.append('start_time', params.start_time);
+			if (params?.end_time) queryParams.append('end_time', params.end_time);
+			if (params?.points) queryParams.append('points', params.points.toString());
+			if (params?.resolution) queryParams.append('resolution', params.resolution);
+			if (params?.measurement_type) queryParams.append('measurement_type', params.measurement_type);
+
+			const query = queryParams.toString() ? `?${queryParams.toString()}` : '';
+			return fetchApi<MeasurementAggregate[]>(`/api/sensors/${id}/measurements/aggregate${query}`);
+		},
 	},
 
 	// Controllers
@@ -154,8 +184,12 @@ export const api = {
 		stopScheduler: () => fetchApi<Record<string, any>>('/api/system/scheduler/stop', {
 			method: 'POST',
 		}),
-		getRecentMeasurements: (hours?: number) => {
-			const query = hours ? `?hours=${hours}` : '';
+		getRecentMeasurements: (hours?: number, points?: number) => {
+			const queryParams = new URLSearchParams();
+			if (hours) queryParams.append('hours', hours.toString());
+			if (points) queryParams.append('points', points.toString());
+
+			const query = queryParams.toString() ? `?${queryParams.toString()}` : '';
 			return fetchApi<any[]>('/api/system/measurements/recent' + query);
 		},
 		getRecentActions: (hours?: number) => {